@@ -8,16 +8,32 @@
 #include <rapidjson/ostreamwrapper.h>
 #include <rapidjson/writer.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 
+#include <climits>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <sstream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
 #include <nopticon.hh>
 
 #define MILLISECONDS_PER_SECOND 1000
@@ -42,32 +58,50 @@ std::string ipv4_format(const nopticon::ip_prefix_t &ip_prefix) {
   return sstream.str();
 }
 
+enum class cmd_t : uint8_t {
+  PRINT_LOG = 0,
+  RESET_NETWORK_SUMMARY,
+  REFRESH_NETWORK_SUMMARY,
+};
+
 class log_t {
 public:
   log_t(std::streambuf *buffer, const nid_to_name_t &nid_to_name,
         unsigned opt_verbosity, bool opt_node_ids, float opt_rank_threshold,
-        const nopticon::spans_t opt_reach_summary_spans)
+        const nopticon::spans_t opt_reach_summary_spans,
+        unsigned opt_keyframe_interval, float opt_delta_epsilon)
       : m_ostream(buffer), m_nid_to_name(nid_to_name),
         m_opt_node_ids{opt_node_ids}, m_opt_rank_threshold{opt_rank_threshold},
-        m_opt_verbosity{opt_verbosity}, m_opt_reach_summary_spans{
-                                            opt_reach_summary_spans} {}
+        m_opt_verbosity{opt_verbosity},
+        m_opt_reach_summary_spans{opt_reach_summary_spans},
+        m_opt_keyframe_interval{opt_keyframe_interval},
+        m_opt_delta_epsilon{opt_delta_epsilon} {}
 
-  void print(const nopticon::analysis_t &);
+  /// In delta mode, a keyframe prints all flows regardless
+  void print(const nopticon::analysis_t &, bool is_keyframe = false);
 
   const nopticon::spans_t &opt_reach_summary_spans() const noexcept {
     return m_opt_reach_summary_spans;
   }
 
 private:
-  friend void process_cmd(nopticon::analysis_t &, log_t &, rapidjson::Document &);
+  friend void process_cmd(nopticon::analysis_t &, log_t &, cmd_t,
+                          nopticon::timestamp_t);
 
   typedef rapidjson::Writer<rapidjson::StringBuffer> writer_t;
 
+  // what has been last printed about each flow, in delta mode
+  typedef std::map<nopticon::nid_t, nopticon::target_t> links_t;
+  typedef std::pair<nopticon::nid_t, nopticon::nid_t> edge_t;
+  typedef std::map<edge_t, nopticon::ranks_t> edges_t;
+
   void print_flows(writer_t &, const nopticon::flow_tree_t &) const;
   void print_flows(writer_t &, const nopticon::affected_flows_t &) const;
   void print_flow(writer_t &, const nopticon::const_flow_t) const;
+  void print_flows_delta(writer_t &, const nopticon::affected_flows_t &);
 
   void print_errors(writer_t &, const nopticon::loops_per_flow_t &) const;
+  void print_policy_events(writer_t &, const nopticon::policy_monitor_t &) const;
 
   void print_reach_summary(writer_t &, const nopticon::flow_tree_t &,
                              const nopticon::reach_summary_t &) const;
@@ -75,9 +109,23 @@ private:
                              const nopticon::reach_summary_t &) const;
   void print_reach_summary(writer_t &, const nopticon::const_flow_t,
                              const nopticon::reach_summary_t &) const;
+  void print_reach_summary_delta(writer_t &, const nopticon::flow_tree_t &,
+                                 const nopticon::reach_summary_t &);
+
+  /// Calls the function with each reachability property of the flow
+  /// that is to be reported, ordered by source and then target
+  template <class F>
+  void for_each_edge(const nopticon::const_flow_t,
+                     const nopticon::reach_summary_t &, F) const;
+  void print_edge(writer_t &, const edge_t &, const nopticon::history_t &,
+                  const nopticon::ranks_t &,
+                  const nopticon::reach_summary_t &) const;
 
   void print_nid(writer_t &, nopticon::nid_t) const;
 
+  static links_t make_links(const nopticon::const_flow_t);
+  void reset_delta(const nopticon::analysis_t &);
+
   std::ostream m_ostream;
   const nid_to_name_t &m_nid_to_name;
 
@@ -85,6 +133,12 @@ private:
   float m_opt_rank_threshold;
   unsigned m_opt_verbosity;
   nopticon::spans_t m_opt_reach_summary_spans;
+  unsigned m_opt_keyframe_interval;
+  float m_opt_delta_epsilon;
+
+  std::size_t m_number_of_records = 0;
+  std::unordered_map<nopticon::flow_id_t, links_t> m_links_per_flow;
+  std::unordered_map<nopticon::flow_id_t, edges_t> m_edges_per_flow;
 };
 
 void log_t::print_nid(writer_t &writer, nopticon::nid_t nid) const {
@@ -160,79 +214,97 @@ void log_t::print_flows(writer_t &writer,
   writer.EndArray();
 }
 
-void log_t::print_reach_summary(
-    writer_t &writer, const nopticon::const_flow_t flow,
-    const nopticon::reach_summary_t &reach_summary) const {
-  static constexpr const char *const s_rank_strings[] = {
-      "rank-0", "rank-1", "rank-2", "rank-3", "rank-4",
-      "rank-5", "rank-6", "rank-7", "rank-8", "rank-9"};
-  static constexpr std::size_t s_rank_strings_len =
-      sizeof(s_rank_strings) / sizeof(s_rank_strings[0]);
-
+template <class F>
+void log_t::for_each_edge(const nopticon::const_flow_t flow,
+                          const nopticon::reach_summary_t &reach_summary,
+                          F f) const {
   assert(flow != nullptr);
   if (flow->is_empty()) {
     return;
   }
-
-  bool is_empty = true;
-  for (nopticon::nid_t s = 0; s < m_nid_to_name.size(); ++s) {
-    for (nopticon::nid_t t = 0; t < m_nid_to_name.size(); ++t) {
-      if (s == t) {
-        continue;
-      }
-      auto &history = reach_summary.history(flow->id, s, t);
-      auto &slices = history.slices();
-      if (slices.empty()) {
-        continue;
-      }
-      auto ranks = reach_summary.ranks(history);
-      if (slices.size() == 2) {
-        assert(ranks.size() == 2);
-        auto distance = std::fabs(ranks.front() - ranks.back());
-        if (distance < m_opt_rank_threshold) {
-          continue;
-        }
-      }
-      bool non_zero_rank = false;
-      for (auto rank : ranks) {
-        if (rank != 0.0f) {
-          non_zero_rank = true;
-        }
-      }
-      if (not non_zero_rank) {
+  // all other histories are empty and so have zero ranks
+  for (auto index : reach_summary.started(flow->id)) {
+    auto s = reach_summary.source(index);
+    auto t = reach_summary.target(index);
+    if (s == t) {
+      continue;
+    }
+    auto &history = reach_summary.history(flow->id, index);
+    auto &slices = history.slices();
+    if (slices.empty()) {
+      continue;
+    }
+    auto &ranks = reach_summary.ranks(history);
+    if (slices.size() == 2) {
+      assert(ranks.size() == 2);
+      auto distance = std::fabs(ranks.front() - ranks.back());
+      if (distance < m_opt_rank_threshold) {
         continue;
       }
-      if (is_empty) {
-        writer.StartObject();
-        writer.Key("flow");
-        writer.String(ipv4_format(flow->ip_prefix));
-        writer.Key("edges");
-        writer.StartArray();
-        is_empty = false;
-      }
-      writer.StartObject();
-      writer.Key("source");
-      print_nid(writer, s);
-      writer.Key("target");
-      print_nid(writer, t);
-      unsigned rank_id = 0;
-      for (auto rank : ranks) {
-        assert(rank_id < s_rank_strings_len);
-        writer.Key(s_rank_strings[rank_id++]);
-        writer.Double(rank);
-      }
-      if (m_opt_verbosity >= 8) {
-        writer.Key("history");
-        writer.StartArray();
-        auto timestamps = history.timestamps(reach_summary.global_stop);
-        for (auto timestamp : timestamps) {
-          writer.Uint64(timestamp);
-        }
-        writer.EndArray();
+    }
+    bool non_zero_rank = false;
+    for (auto rank : ranks) {
+      if (rank != 0.0f) {
+        non_zero_rank = true;
       }
-      writer.EndObject();
     }
+    if (not non_zero_rank) {
+      continue;
+    }
+    f(edge_t{s, t}, history, ranks);
+  }
+}
+
+void log_t::print_edge(writer_t &writer, const edge_t &edge,
+                       const nopticon::history_t &history,
+                       const nopticon::ranks_t &ranks,
+                       const nopticon::reach_summary_t &reach_summary) const {
+  static constexpr const char *const s_rank_strings[] = {
+      "rank-0", "rank-1", "rank-2", "rank-3", "rank-4",
+      "rank-5", "rank-6", "rank-7", "rank-8", "rank-9"};
+  static constexpr std::size_t s_rank_strings_len =
+      sizeof(s_rank_strings) / sizeof(s_rank_strings[0]);
+
+  writer.StartObject();
+  writer.Key("source");
+  print_nid(writer, edge.first);
+  writer.Key("target");
+  print_nid(writer, edge.second);
+  unsigned rank_id = 0;
+  for (auto rank : ranks) {
+    assert(rank_id < s_rank_strings_len);
+    writer.Key(s_rank_strings[rank_id++]);
+    writer.Double(rank);
   }
+  if (m_opt_verbosity >= 8) {
+    writer.Key("history");
+    writer.StartArray();
+    auto timestamps = history.timestamps(reach_summary.global_stop);
+    for (auto timestamp : timestamps) {
+      writer.Uint64(timestamp);
+    }
+    writer.EndArray();
+  }
+  writer.EndObject();
+}
+
+void log_t::print_reach_summary(
+    writer_t &writer, const nopticon::const_flow_t flow,
+    const nopticon::reach_summary_t &reach_summary) const {
+  bool is_empty = true;
+  for_each_edge(flow, reach_summary,
+                [&](const edge_t &edge, const nopticon::history_t &history,
+                    const nopticon::ranks_t &ranks) {
+                  if (is_empty) {
+                    writer.StartObject();
+                    writer.Key("flow");
+                    writer.String(ipv4_format(flow->ip_prefix));
+                    writer.Key("edges");
+                    writer.StartArray();
+                    is_empty = false;
+                  }
+                  print_edge(writer, edge, history, ranks, reach_summary);
+                });
   if (not is_empty) {
     writer.EndArray();
     writer.EndObject();
@@ -263,6 +335,188 @@ void log_t::print_reach_summary(
   writer.EndArray();
 }
 
+log_t::links_t log_t::make_links(const nopticon::const_flow_t flow) {
+  links_t links;
+  for (auto &kv : flow->data) {
+    links.emplace(kv.first, kv.second->target);
+  }
+  return links;
+}
+
+void log_t::print_flows_delta(
+    writer_t &writer, const nopticon::affected_flows_t &affected_flows) {
+  bool is_empty = true;
+  for (auto flow : affected_flows) {
+    if (flow->is_empty()) {
+      continue;
+    }
+    auto links = make_links(flow);
+    auto &last_links = m_links_per_flow[flow->id];
+    if (links == last_links) {
+      continue;
+    }
+    if (is_empty) {
+      writer.Key("flows-delta");
+      writer.StartArray();
+      is_empty = false;
+    }
+    writer.StartObject();
+    writer.Key("flow");
+    writer.String(ipv4_format(flow->ip_prefix));
+    writer.Key("links");
+    writer.StartArray();
+    for (auto &link : links) {
+      auto last_link_iter = last_links.find(link.first);
+      if (last_link_iter != last_links.end() and
+          last_link_iter->second == link.second) {
+        continue;
+      }
+      writer.StartObject();
+      writer.Key("source");
+      print_nid(writer, link.first);
+      writer.Key("target");
+      writer.StartArray();
+      for (auto &t : link.second) {
+        print_nid(writer, t);
+      }
+      writer.EndArray();
+      writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("removed-links");
+    writer.StartArray();
+    for (auto &last_link : last_links) {
+      if (links.count(last_link.first) == 0) {
+        print_nid(writer, last_link.first);
+      }
+    }
+    writer.EndArray();
+    writer.EndObject();
+    last_links = std::move(links);
+  }
+  if (not is_empty) {
+    writer.EndArray();
+  }
+}
+
+void log_t::print_reach_summary_delta(
+    writer_t &writer, const nopticon::flow_tree_t &flow_tree,
+    const nopticon::reach_summary_t &reach_summary) {
+  typedef std::tuple<edge_t, const nopticon::history_t *, nopticon::ranks_t>
+      changed_edge_t;
+  std::vector<changed_edge_t> changed_edges;
+  std::vector<edge_t> removed_edges;
+  bool is_empty = true;
+  auto flow_tree_iter = flow_tree.iter();
+  do {
+    auto flow = flow_tree_iter.ptr();
+    auto last_edges_iter = m_edges_per_flow.find(flow->id);
+    edges_t *last_edges = last_edges_iter == m_edges_per_flow.end()
+                              ? nullptr
+                              : &last_edges_iter->second;
+    edges_t edges;
+    for_each_edge(flow, reach_summary,
+                  [&](const edge_t &edge, const nopticon::history_t &history,
+                      const nopticon::ranks_t &ranks) {
+                    edges.emplace(edge, ranks);
+                    if (last_edges != nullptr) {
+                      auto iter = last_edges->find(edge);
+                      if (iter != last_edges->end()) {
+                        bool is_changed = false;
+                        for (std::size_t i = 0; i < ranks.size(); ++i) {
+                          if (ranks[i] != iter->second[i] and
+                              std::fabs(ranks[i] - iter->second[i]) >=
+                                  m_opt_delta_epsilon) {
+                            is_changed = true;
+                          }
+                        }
+                        if (not is_changed) {
+                          // keep the last printed ranks so that small
+                          // changes cannot accumulate unnoticed
+                          edges[edge] = iter->second;
+                          return;
+                        }
+                      }
+                    }
+                    changed_edges.emplace_back(edge, &history, ranks);
+                  });
+    if (last_edges != nullptr) {
+      for (auto &last_edge : *last_edges) {
+        if (edges.count(last_edge.first) == 0) {
+          removed_edges.push_back(last_edge.first);
+        }
+      }
+    }
+    if (changed_edges.empty() and removed_edges.empty()) {
+      continue;
+    }
+    if (is_empty) {
+      writer.Key("reach-summary-delta");
+      writer.StartArray();
+      is_empty = false;
+    }
+    writer.StartObject();
+    writer.Key("flow");
+    writer.String(ipv4_format(flow->ip_prefix));
+    writer.Key("edges");
+    writer.StartArray();
+    for (auto &changed_edge : changed_edges) {
+      print_edge(writer, std::get<0>(changed_edge), *std::get<1>(changed_edge),
+                 std::get<2>(changed_edge), reach_summary);
+    }
+    writer.EndArray();
+    writer.Key("removed-edges");
+    writer.StartArray();
+    for (auto &removed_edge : removed_edges) {
+      writer.StartObject();
+      writer.Key("source");
+      print_nid(writer, removed_edge.first);
+      writer.Key("target");
+      print_nid(writer, removed_edge.second);
+      writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    changed_edges.clear();
+    removed_edges.clear();
+    if (edges.empty()) {
+      m_edges_per_flow.erase(flow->id);
+    } else {
+      m_edges_per_flow[flow->id] = std::move(edges);
+    }
+  } while (flow_tree_iter.next());
+  if (not is_empty) {
+    writer.EndArray();
+  }
+}
+
+void log_t::reset_delta(const nopticon::analysis_t &analysis) {
+  m_links_per_flow.clear();
+  m_edges_per_flow.clear();
+  auto flow_tree_iter = analysis.flow_graph().flow_tree().iter();
+  do {
+    auto flow = flow_tree_iter.ptr();
+    if (flow->is_empty()) {
+      continue;
+    }
+    if (not flow->data.empty()) {
+      m_links_per_flow.emplace(flow->id, make_links(flow));
+    }
+    if (m_opt_verbosity < 7 or m_opt_reach_summary_spans.empty()) {
+      continue;
+    }
+    edges_t edges;
+    for_each_edge(flow, analysis.reach_summary(),
+                  [&](const edge_t &edge, const nopticon::history_t &,
+                      const nopticon::ranks_t &ranks) {
+                    edges.emplace(edge, ranks);
+                  });
+    if (not edges.empty()) {
+      m_edges_per_flow.emplace(flow->id, std::move(edges));
+    }
+  } while (flow_tree_iter.next());
+}
+
 void log_t::print_errors(
     writer_t &writer, const nopticon::loops_per_flow_t &loops_per_flow) const {
   bool is_empty = true;
@@ -297,7 +551,52 @@ void log_t::print_errors(
   }
 }
 
-void log_t::print(const nopticon::analysis_t &analysis) {
+static const char *const s_policy_type_names[] = {
+    "reachability", "waypoint", "path-preference"};
+
+void log_t::print_policy_events(
+    writer_t &writer, const nopticon::policy_monitor_t &policy_monitor) const {
+  auto &events = policy_monitor.events();
+  if (events.empty()) {
+    return;
+  }
+  writer.Key("policy-events");
+  writer.StartArray();
+  for (auto &event : events) {
+    auto &policy = policy_monitor.policy(event.policy_id);
+    writer.StartObject();
+    writer.Key("policy");
+    writer.Uint64(event.policy_id);
+    writer.Key("type");
+    writer.String(s_policy_type_names[static_cast<uint8_t>(policy.type)]);
+    writer.Key("flow");
+    writer.String(ipv4_format(policy.ip_prefix));
+    writer.Key("paths");
+    writer.StartArray();
+    for (auto &path : policy.paths) {
+      writer.StartArray();
+      for (auto nid : path) {
+        print_nid(writer, nid);
+      }
+      writer.EndArray();
+    }
+    writer.EndArray();
+    writer.Key("status");
+    writer.String(event.holds ? "recovered" : "violated");
+    writer.EndObject();
+  }
+  writer.EndArray();
+}
+
+void log_t::print(const nopticon::analysis_t &analysis, bool is_keyframe) {
+  // Only output about all flows, which is what grows with the
+  // length of a run, is delta-encoded
+  const bool is_delta_mode =
+      m_opt_keyframe_interval != 0 and m_opt_verbosity >= 6;
+  if (is_delta_mode and m_number_of_records++ % m_opt_keyframe_interval == 0) {
+    is_keyframe = true;
+  }
+  const bool is_delta = is_delta_mode and not is_keyframe;
   rapidjson::StringBuffer s;
   writer_t writer{s};
   writer.StartObject();
@@ -314,28 +613,45 @@ void log_t::print(const nopticon::analysis_t &analysis) {
     }
     writer.EndArray();
   }
+  if (is_delta_mode and is_keyframe) {
+    writer.Key("keyframe");
+    writer.Bool(true);
+  }
   if (not m_opt_reach_summary_spans.empty()) {
     if (m_opt_verbosity >= 7) {
-      print_reach_summary(writer, analysis.flow_graph().flow_tree(),
+      if (is_delta) {
+        print_reach_summary_delta(writer, analysis.flow_graph().flow_tree(),
+                                  analysis.reach_summary());
+      } else {
+        print_reach_summary(writer, analysis.flow_graph().flow_tree(),
                             analysis.reach_summary());
+      }
     } else if (m_opt_verbosity >= 5) {
       print_reach_summary(writer, analysis.affected_flows(),
                             analysis.reach_summary());
     }
   }
   if (m_opt_verbosity >= 6) {
-    print_flows(writer, analysis.flow_graph().flow_tree());
+    if (is_delta) {
+      print_flows_delta(writer, analysis.affected_flows());
+    } else {
+      print_flows(writer, analysis.flow_graph().flow_tree());
+    }
   } else if (m_opt_verbosity >= 4) {
     print_flows(writer, analysis.affected_flows());
   }
   if (m_opt_verbosity >= 1) {
     print_errors(writer, analysis.loops_per_flow());
+    print_policy_events(writer, analysis.policy_monitor());
   }
   writer.EndObject();
   if (s.GetLength() > 2) {
     // longer than "{}"
     m_ostream << s.GetString() << std::endl;
   }
+  if (is_delta_mode and is_keyframe) {
+    reset_delta(analysis);
+  }
 }
 
 /// \post every nid is strictly less than `name_to_nid.size()`
@@ -401,43 +717,121 @@ nopticon::ip_prefix_t make_ip_prefix(const std::string &ip_prefix) {
   return {};
 }
 
-enum class cmd_t : uint8_t {
-  PRINT_LOG = 0,
-  RESET_NETWORK_SUMMARY,
-  REFRESH_NETWORK_SUMMARY,
-};
+int read_nid(const rapidjson::Value &name, const string_to_nid_t &name_to_nid,
+             nopticon::path_t &path) {
+  auto iter = name_to_nid.find(name.GetString());
+  if (iter == name_to_nid.end()) {
+    std::cerr << "Unknown router in policy: " << name.GetString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  path.push_back(iter->second);
+  return EXIT_SUCCESS;
+}
 
-void process_cmd(nopticon::analysis_t &analysis, log_t &log,
-                 rapidjson::Document &document) {
-  assert(document["Command"].HasMember("Opcode"));
-  assert(document["Command"]["Opcode"].IsUint());
+/// Same format as the policies that scripts/check_policies.py reads,
+/// extended by a 'waypoint' type that has a 'waypoints' array
+int read_policies(FILE *file, const string_to_nid_t &name_to_nid,
+                  std::vector<nopticon::policy_t> &policies) {
+  assert(file != nullptr);
+  char read_buffer[std::numeric_limits<uint16_t>::max()];
+  rapidjson::FileReadStream input(file, read_buffer, sizeof(read_buffer));
+  rapidjson::Document document;
+  document.ParseStream(input);
+  if (document.HasParseError()) {
+    std::cerr << "Malformed policies JSON object" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (not document.HasMember("policies")) {
+    std::cerr << "Expected 'policies' array in top-level policies object"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (auto &value : document["policies"].GetArray()) {
+    if (not value.HasMember("type") or not value.HasMember("flow")) {
+      std::cerr << "Expected 'type' and 'flow' fields in each policy"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    nopticon::policy_t policy;
+    policy.ip_prefix = make_ip_prefix(value["flow"].GetString());
+    std::string type = value["type"].GetString();
+    if (type == "path-preference") {
+      policy.type = nopticon::policy_type_t::PATH_PREFERENCE;
+      if (not value.HasMember("paths")) {
+        std::cerr << "Expected 'paths' array in path-preference policy"
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+      for (auto &names : value["paths"].GetArray()) {
+        policy.paths.emplace_back();
+        for (auto &name : names.GetArray()) {
+          if (read_nid(name, name_to_nid, policy.paths.back())) {
+            return EXIT_FAILURE;
+          }
+        }
+      }
+      if (policy.paths.empty()) {
+        std::cerr << "Expected non-empty 'paths' array" << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (type == "reachability" or type == "waypoint") {
+      policy.type = type == "waypoint" ? nopticon::policy_type_t::WAYPOINT
+                                       : nopticon::policy_type_t::REACHABILITY;
+      if (not value.HasMember("source") or not value.HasMember("target")) {
+        std::cerr << "Expected 'source' and 'target' fields in " << type
+                  << " policy" << std::endl;
+        return EXIT_FAILURE;
+      }
+      policy.paths.emplace_back();
+      auto &path = policy.paths.back();
+      if (read_nid(value["source"], name_to_nid, path)) {
+        return EXIT_FAILURE;
+      }
+      if (value.HasMember("waypoints")) {
+        for (auto &waypoint : value["waypoints"].GetArray()) {
+          if (read_nid(waypoint, name_to_nid, path)) {
+            return EXIT_FAILURE;
+          }
+        }
+      }
+      if (read_nid(value["target"], name_to_nid, path)) {
+        return EXIT_FAILURE;
+      }
+    } else {
+      std::cerr << "Unknown policy type: " << type << std::endl;
+      return EXIT_FAILURE;
+    }
+    policies.push_back(std::move(policy));
+  }
+  return EXIT_SUCCESS;
+}
+
+nopticon::timestamp_t make_timestamp(const rapidjson::Value &value) {
+  if (value.IsUint64()) {
+    // Convert time in seconds to time in milliseconds
+    return value.GetUint64() * MILLISECONDS_PER_SECOND;
+  }
+  // Convert time in seconds and nanoseconds to time in milliseconds
+  assert(value.IsDouble());
+  return static_cast<nopticon::timestamp_t>(value.GetDouble() *
+                                            MILLISECONDS_PER_SECOND);
+}
+
+void process_cmd(nopticon::analysis_t &analysis, log_t &log, cmd_t cmd,
+                 nopticon::timestamp_t timestamp) {
   unsigned highest_verbosity;
-  nopticon::timestamp_t timestamp;
-  auto opcode = document["Command"]["Opcode"].GetUint();
-  auto cmd = static_cast<cmd_t>(opcode);
   switch (cmd) {
   case cmd_t::PRINT_LOG:
     highest_verbosity = 8;
     std::swap(log.m_opt_verbosity, highest_verbosity);
-    log.print(analysis);
+    log.print(analysis, /* is_keyframe */ true);
     std::swap(log.m_opt_verbosity, highest_verbosity);
     break;
   case cmd_t::RESET_NETWORK_SUMMARY:
     analysis.reset_reach_summary();
     break;
   case cmd_t::REFRESH_NETWORK_SUMMARY:
-    assert(document["Command"].HasMember("Timestamp"));
-    if (document["Command"]["Timestamp"].IsUint64()) {
-        // Convert time in seconds to time in milliseconds
-        timestamp = document["Command"]["Timestamp"].GetUint64()
-            * MILLISECONDS_PER_SECOND;
-    } else {
-        // Convert time in seconds and nanoseconds to time in milliseconds
-        assert(document["Command"]["Timestamp"].IsDouble());
-        timestamp = static_cast<nopticon::timestamp_t>(
-                document["Command"]["Timestamp"].GetDouble()
-                * MILLISECONDS_PER_SECOND);
-    }
+    assert(timestamp != 0);
     analysis.refresh_reach_summary(timestamp);
     break;
   default:
@@ -446,19 +840,642 @@ void process_cmd(nopticon::analysis_t &analysis, log_t &log,
   }
 }
 
-void process_bmp_message(std::size_t number_of_nodes, FILE *file,
-                         const string_to_nid_t &ip_to_nid, log_t &log) {
+void process_cmd(nopticon::analysis_t &analysis, log_t &log,
+                 const rapidjson::Value &command) {
+  assert(command.HasMember("Opcode"));
+  assert(command["Opcode"].IsUint());
+  nopticon::timestamp_t timestamp = 0;
+  auto opcode = command["Opcode"].GetUint();
+  auto cmd = static_cast<cmd_t>(opcode);
+  if (cmd == cmd_t::REFRESH_NETWORK_SUMMARY) {
+    // A scheduled refresh defaults to the time at which it is due
+    assert(command.HasMember("Timestamp") or command.HasMember("At"));
+    timestamp = make_timestamp(command.HasMember("Timestamp")
+                                   ? command["Timestamp"]
+                                   : command["At"]);
+  }
+  process_cmd(analysis, log, cmd, timestamp);
+}
+
+/// Commands that recur at fixed intervals of BMP time, or whenever
+/// a BMP peer up or peer down message arrives
+class schedule_t {
+public:
+  /// Fire at every multiple of the interval (milliseconds)
+  void every(cmd_t cmd, nopticon::duration_t interval) {
+    assert(interval != 0);
+    m_periodic_cmds.push_back({cmd, interval, 0});
+  }
+
+  void on_peer_change(cmd_t cmd) { m_peer_change_cmds.push_back(cmd); }
+
+  bool empty() const noexcept {
+    return m_periodic_cmds.empty() and m_peer_change_cmds.empty();
+  }
+
+  /// Fire each periodic command whose time has come; a command that
+  /// was due several times since the last call fires only once
+  void advance(nopticon::analysis_t &, log_t &, nopticon::timestamp_t);
+
+  void peer_change(nopticon::analysis_t &, log_t &, nopticon::timestamp_t);
+
+private:
+  struct periodic_cmd_t {
+    cmd_t cmd;
+    nopticon::duration_t interval;
+    nopticon::timestamp_t next;
+  };
+
+  std::vector<periodic_cmd_t> m_periodic_cmds;
+  std::vector<cmd_t> m_peer_change_cmds;
+};
+
+void schedule_t::advance(nopticon::analysis_t &analysis, log_t &log,
+                         nopticon::timestamp_t timestamp) {
+  for (auto &periodic_cmd : m_periodic_cmds) {
+    if (periodic_cmd.next == 0) {
+      periodic_cmd.next =
+          (timestamp / periodic_cmd.interval + 1) * periodic_cmd.interval;
+    }
+  }
+  for (;;) {
+    // earliest due command first, and in the order of cmd_t on ties
+    // so that a dump precedes a refresh at the same time
+    periodic_cmd_t *due = nullptr;
+    for (auto &periodic_cmd : m_periodic_cmds) {
+      if (periodic_cmd.next > timestamp) {
+        continue;
+      }
+      if (due == nullptr or periodic_cmd.next < due->next or
+          (periodic_cmd.next == due->next and periodic_cmd.cmd < due->cmd)) {
+        due = &periodic_cmd;
+      }
+    }
+    if (due == nullptr) {
+      break;
+    }
+    process_cmd(analysis, log, due->cmd, due->next);
+    due->next = (timestamp / due->interval + 1) * due->interval;
+  }
+}
+
+void schedule_t::peer_change(nopticon::analysis_t &analysis, log_t &log,
+                             nopticon::timestamp_t timestamp) {
+  for (auto cmd : m_peer_change_cmds) {
+    process_cmd(analysis, log, cmd, timestamp);
+  }
+}
+
+/// Commands that arrive through a side channel, e.g. a named pipe,
+/// rather than inlined into the stream of BMP messages.
+///
+/// Each command is a single line in the same JSON format as inlined
+/// commands. A command whose "At" field is set (in seconds, just like
+/// a BMP timestamp) is deferred until the BMP stream reaches that time.
+class control_t {
+public:
+  control_t(int fd) : m_fd{fd} {}
+  ~control_t() { close(m_fd); }
+
+  control_t(const control_t &) = delete;
+  control_t &operator=(const control_t &) = delete;
+
+  /// Read commands without blocking, and apply those that are not deferred
+  void poll(nopticon::analysis_t &, log_t &);
+
+  /// Apply deferred commands that are due at or before the given time
+  void advance(nopticon::analysis_t &, log_t &, nopticon::timestamp_t);
+
+  /// Apply all deferred commands, in order of their due time
+  void flush(nopticon::analysis_t &, log_t &);
+
+private:
+  typedef std::unique_ptr<rapidjson::Document> document_ptr_t;
+
+  int m_fd;
+  std::string m_line;
+  // insertion order is preserved for commands due at the same time
+  std::multimap<nopticon::timestamp_t, document_ptr_t> m_deferred;
+};
+
+void control_t::poll(nopticon::analysis_t &analysis, log_t &log) {
+  char read_buffer[4096];
+  ssize_t n;
+  while ((n = read(m_fd, read_buffer, sizeof(read_buffer))) > 0) {
+    m_line.append(read_buffer, n);
+  }
+  std::size_t begin = 0, end;
+  while ((end = m_line.find('\n', begin)) != std::string::npos) {
+    if (begin == end) {
+      ++begin;
+      continue;
+    }
+    document_ptr_t document{new rapidjson::Document};
+    document->Parse(m_line.c_str() + begin, end - begin);
+    begin = end + 1;
+    if (document->HasParseError() or not document->IsObject() or not document->HasMember("Command") or
+        not(*document)["Command"].HasMember("Opcode")) {
+      std::cerr << "Malformed gobgp-analysis command" << std::endl;
+      continue;
+    }
+    auto &command = (*document)["Command"];
+    if (command.HasMember("At")) {
+      m_deferred.emplace(make_timestamp(command["At"]), std::move(document));
+    } else {
+      process_cmd(analysis, log, command);
+    }
+  }
+  m_line.erase(0, begin);
+}
+
+void control_t::advance(nopticon::analysis_t &analysis, log_t &log,
+                        nopticon::timestamp_t timestamp) {
+  auto iter = m_deferred.begin();
+  for (; iter != m_deferred.end() and iter->first <= timestamp; ++iter) {
+    process_cmd(analysis, log, (*iter->second)["Command"]);
+  }
+  m_deferred.erase(m_deferred.begin(), iter);
+}
+
+void control_t::flush(nopticon::analysis_t &analysis, log_t &log) {
+  for (auto &pair : m_deferred) {
+    process_cmd(analysis, log, (*pair.second)["Command"]);
+  }
+  m_deferred.clear();
+}
+
+/// Size of the gzip member at the start of the data if its header has a
+/// BGZF 'BC' subfield, as written by bgzip, or otherwise zero
+static std::size_t gzip_block_size(const unsigned char *data,
+                                   std::size_t size) {
+  constexpr unsigned char FEXTRA = 0x4;
+  if (size < 18 or data[0] != 0x1f or data[1] != 0x8b or data[2] != 8 or
+      not(data[3] & FEXTRA)) {
+    return 0;
+  }
+  std::size_t xlen = data[10] | data[11] << 8;
+  for (std::size_t i = 12; i + 4 <= 12 + xlen and i + 4 <= size;) {
+    std::size_t slen = data[i + 2] | data[i + 3] << 8;
+    if (data[i] == 'B' and data[i + 1] == 'C' and slen == 2 and
+        i + 6 <= size) {
+      // header, compressed data, CRC32 and ISIZE
+      std::size_t block_size = (data[i + 4] | data[i + 5] << 8) + 1;
+      if (block_size < 12 + xlen + 8 or block_size > size) {
+        return 0;
+      }
+      return block_size;
+    }
+    i += 4 + slen;
+  }
+  return 0;
+}
+
+/// Memory-mapped capture of BMP messages, one JSON object per line, as
+/// written by gobmpd, either plain or gzip-compressed. A compressed
+/// capture is inflated into segments of whole lines, the next segment
+/// while the current one is processed; its gzip members are inflated in
+/// parallel if they record their size, as those written by bgzip. Lines
+/// are parsed in batches by several threads, ahead of the batch whose
+/// messages are being processed, in order.
+class replay_t {
+public:
+  typedef std::function<void(const rapidjson::Document &)> process_t;
+
+  replay_t() = default;
+  ~replay_t();
+
+  replay_t(const replay_t &) = delete;
+  replay_t &operator=(const replay_t &) = delete;
+
+  /// Maps the file; false if the file cannot be read
+  bool open(const char *file_name);
+
+  /// Processes every message in file order, and reports the progress on
+  /// stderr; fails at the first malformed message or gzip member
+  int run(const process_t &);
+
+private:
+  typedef rapidjson::Document::AllocatorType allocator_t;
+  typedef std::unique_ptr<rapidjson::Document> document_ptr_t;
+  typedef std::vector<std::pair<std::size_t, std::size_t>> lines_t;
+
+  /// Whole lines of the capture; they are in the mapped file itself
+  /// unless the capture is compressed
+  struct segment_t {
+    std::string buffer;
+    // start and length of each non-empty line
+    lines_t lines;
+    // bytes of the file read before and after the segment
+    std::size_t begin = 0, end = 0;
+    bool is_last = true;
+  };
+
+  struct batch_t {
+    // the documents parsed by a thread share its memory pool, which is
+    // released with the batch
+    std::vector<std::unique_ptr<allocator_t>> allocators;
+    std::vector<document_ptr_t> documents;
+  };
+
+  static constexpr std::size_t BATCH_SIZE = 1 << 12;
+  // uncompressed bytes of a segment, and of each inflate call
+  static constexpr std::size_t SEGMENT_SIZE = 1 << 24;
+  static constexpr std::size_t CHUNK_SIZE = 1 << 18;
+
+  template <class F> void for_each_chunk(std::size_t n, F f) const;
+  segment_t read_segment();
+  bool inflate_stream(std::string &);
+  bool inflate_blocks(std::string &);
+  batch_t parse(const char *data, const lines_t &, std::size_t begin,
+                std::size_t end) const;
+  void report(const segment_t &, std::size_t number_of_processed_lines,
+              bool is_done);
+
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+  bool m_is_gzip = false, m_is_blocked = false;
+  // state of read_segment(): the bytes of the file read so far, whether
+  // they end within a gzip member, and the trailing partial line of the
+  // previous segment
+  std::size_t m_offset = 0;
+  z_stream m_stream{};
+  bool m_is_in_member = false;
+  std::string m_carry;
+  std::string m_error;
+  std::size_t m_number_of_processed_messages = 0;
+  unsigned m_number_of_threads = 1;
+  // with a single hardware thread, there is nothing to parse ahead with
+  std::size_t m_batch_size = 1;
+  std::launch m_launch_policy = std::launch::deferred;
+  std::chrono::steady_clock::time_point m_start, m_last_report;
+};
+
+replay_t::~replay_t() {
+  if (m_is_gzip and not m_is_blocked) {
+    inflateEnd(&m_stream);
+  }
+  if (m_data != nullptr) {
+    munmap(const_cast<char *>(m_data), m_size);
+  }
+}
+
+bool replay_t::open(const char *file_name) {
+  auto fd = ::open(file_name, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return false;
+  }
+  m_size = st.st_size;
+  if (m_size != 0) {
+    auto data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char *>(data);
+  }
+  close(fd);
+
+  auto bytes = reinterpret_cast<const unsigned char *>(m_data);
+  m_is_gzip = m_size >= 2 and bytes[0] == 0x1f and bytes[1] == 0x8b;
+  if (m_is_gzip) {
+    m_is_blocked = gzip_block_size(bytes, m_size) != 0;
+    if (not m_is_blocked and
+        inflateInit2(&m_stream, 16 + MAX_WBITS) != Z_OK) {
+      m_is_gzip = false;
+      return false;
+    }
+  }
+  m_number_of_threads = std::max(1U, std::thread::hardware_concurrency());
+  if (m_number_of_threads > 1) {
+    m_batch_size = BATCH_SIZE;
+    m_launch_policy = std::launch::async;
+  }
+  return true;
+}
+
+/// Calls f(k, i, j) for the k-th of consecutive ranges [i, j) that
+/// partition [0, n), one range per thread
+template <class F> void replay_t::for_each_chunk(std::size_t n, F f) const {
+  auto chunk = (n + m_number_of_threads - 1) / m_number_of_threads;
+  std::vector<std::thread> threads;
+  for (std::size_t i = chunk, k = 1; i < n; i += chunk, ++k) {
+    threads.emplace_back(f, k, i, std::min(i + chunk, n));
+  }
+  if (n != 0) {
+    f(0, 0, std::min(chunk, n));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+bool replay_t::inflate_stream(std::string &buffer) {
+  auto size = buffer.size();
+  while (buffer.size() < size + SEGMENT_SIZE and m_offset < m_size) {
+    auto n = buffer.size();
+    buffer.resize(n + CHUNK_SIZE);
+    m_stream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(m_data + m_offset));
+    m_stream.avail_in = std::min<std::size_t>(m_size - m_offset, UINT_MAX);
+    m_stream.next_out = reinterpret_cast<Bytef *>(&buffer[n]);
+    m_stream.avail_out = CHUNK_SIZE;
+    auto status = inflate(&m_stream, Z_NO_FLUSH);
+    m_offset = reinterpret_cast<const char *>(m_stream.next_in) - m_data;
+    buffer.resize(n + CHUNK_SIZE - m_stream.avail_out);
+    if (status == Z_STREAM_END) {
+      // the next gzip member, if any, continues the capture
+      m_is_in_member = false;
+      inflateReset(&m_stream);
+    } else if (status == Z_OK) {
+      m_is_in_member = true;
+    } else {
+      m_error = "corrupt gzip data";
+      return false;
+    }
+  }
+  if (m_offset == m_size and m_is_in_member) {
+    m_error = "truncated gzip data";
+    return false;
+  }
+  return true;
+}
+
+bool replay_t::inflate_blocks(std::string &buffer) {
+  // each block is inflated into its place in the buffer, which is given
+  // by the sizes of the preceding blocks in their gzip trailers
+  std::vector<std::size_t> offsets, block_sizes, outputs;
+  auto size = buffer.size(), output = size;
+  while (output < size + SEGMENT_SIZE and m_offset < m_size) {
+    auto data = reinterpret_cast<const unsigned char *>(m_data + m_offset);
+    auto block_size = gzip_block_size(data, m_size - m_offset);
+    if (block_size == 0) {
+      m_error = "malformed gzip block";
+      return false;
+    }
+    offsets.push_back(m_offset);
+    block_sizes.push_back(block_size);
+    outputs.push_back(output);
+    auto isize = data + block_size - 4;
+    output += isize[0] | isize[1] << 8 | isize[2] << 16 |
+              static_cast<uint32_t>(isize[3]) << 24;
+    m_offset += block_size;
+  }
+  outputs.push_back(output);
+  buffer.resize(output);
+
+  std::atomic<bool> is_ok{true};
+  for_each_chunk(offsets.size(), [&](std::size_t, std::size_t i,
+                                     std::size_t j) {
+    z_stream stream{};
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+      is_ok = false;
+      return;
+    }
+    for (; i < j and is_ok; ++i) {
+      stream.next_in =
+          reinterpret_cast<Bytef *>(const_cast<char *>(m_data + offsets[i]));
+      stream.avail_in = block_sizes[i];
+      stream.next_out = reinterpret_cast<Bytef *>(&buffer[0] + outputs[i]);
+      stream.avail_out = outputs[i + 1] - outputs[i];
+      if (inflate(&stream, Z_FINISH) != Z_STREAM_END or
+          stream.avail_out != 0) {
+        is_ok = false;
+      }
+      inflateReset(&stream);
+    }
+    inflateEnd(&stream);
+  });
+  if (not is_ok) {
+    m_error = "corrupt gzip block";
+  }
+  return is_ok;
+}
+
+replay_t::segment_t replay_t::read_segment() {
+  segment_t segment;
+  segment.begin = m_offset;
+  auto data = m_data;
+  auto size = m_size;
+  if (m_is_gzip) {
+    segment.buffer.swap(m_carry);
+    if (not(m_is_blocked ? inflate_blocks(segment.buffer)
+                         : inflate_stream(segment.buffer))) {
+      return segment;
+    }
+    segment.is_last = m_offset == m_size;
+    if (not segment.is_last) {
+      // the trailing partial line is completed by the next segment
+      auto end = segment.buffer.rfind('\n') + 1;
+      m_carry.assign(segment.buffer, end, std::string::npos);
+      segment.buffer.resize(end);
+    }
+    data = segment.buffer.data();
+    size = segment.buffer.size();
+  } else {
+    m_offset = m_size;
+  }
+  segment.end = m_offset;
+
+  std::size_t begin = 0;
+  while (begin < size) {
+    auto newline =
+        static_cast<const char *>(std::memchr(data + begin, '\n', size - begin));
+    auto end = newline == nullptr ? size : newline - data;
+    if (begin != end) {
+      segment.lines.emplace_back(begin, end - begin);
+    }
+    begin = end + 1;
+  }
+  return segment;
+}
+
+replay_t::batch_t replay_t::parse(const char *data, const lines_t &lines,
+                                  std::size_t begin, std::size_t end) const {
+  batch_t batch;
+  auto &documents = batch.documents;
+  documents.resize(end - begin);
+  for (std::size_t i = 0; i < m_number_of_threads; ++i) {
+    batch.allocators.emplace_back(new allocator_t);
+  }
+  for_each_chunk(documents.size(),
+                 [&](std::size_t k, std::size_t i, std::size_t j) {
+                   auto allocator = batch.allocators[k].get();
+                   for (; i < j; ++i) {
+                     auto &line = lines[begin + i];
+                     documents[i].reset(new rapidjson::Document{allocator});
+                     documents[i]->Parse(data + line.first, line.second);
+                   }
+                 });
+  return batch;
+}
+
+void replay_t::report(const segment_t &segment,
+                      std::size_t number_of_processed_lines, bool is_done) {
+  auto now = std::chrono::steady_clock::now();
+  if (not is_done and now - m_last_report < std::chrono::seconds(1)) {
+    return;
+  }
+  m_last_report = now;
+  std::chrono::duration<double> elapsed = now - m_start;
+  auto rate = m_number_of_processed_messages / std::max(elapsed.count(), 1e-9);
+  // fraction of the file processed, interpolated within the segment
+  auto progress =
+      (segment.begin + static_cast<double>(segment.end - segment.begin) *
+                           number_of_processed_lines /
+                           std::max<std::size_t>(segment.lines.size(), 1)) /
+      std::max<std::size_t>(m_size, 1);
+  std::cerr << "\rreplay: " << m_number_of_processed_messages
+            << " messages (" << 100.0 * progress << "% of the file), "
+            << static_cast<std::size_t>(rate) << " messages/s, ETA "
+            << static_cast<std::size_t>(elapsed.count() * (1 - progress) /
+                                        std::max(progress, 1e-9))
+            << "s   ";
+  if (is_done) {
+    std::cerr << std::endl;
+  }
+}
+
+int replay_t::run(const process_t &process) {
+  m_start = m_last_report = std::chrono::steady_clock::now();
+  auto next_segment =
+      std::async(m_launch_policy, &replay_t::read_segment, this);
+  for (;;) {
+    auto segment = next_segment.get();
+    if (not m_error.empty()) {
+      report(segment, 0, true);
+      std::cerr << "Malformed replay file: " << m_error << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (not segment.is_last) {
+      next_segment = std::async(m_launch_policy, &replay_t::read_segment, this);
+    }
+    auto data = m_is_gzip ? segment.buffer.data() : m_data;
+    auto &lines = segment.lines;
+    auto n = lines.size();
+    auto next = std::async(m_launch_policy, &replay_t::parse, this, data,
+                           std::cref(lines), 0, std::min(m_batch_size, n));
+    for (std::size_t begin = 0; begin < n; begin += m_batch_size) {
+      auto batch = next.get();
+      auto &documents = batch.documents;
+      auto end = begin + documents.size();
+      if (end < n) {
+        next = std::async(m_launch_policy, &replay_t::parse, this, data,
+                          std::cref(lines), end,
+                          std::min(end + m_batch_size, n));
+      }
+      for (std::size_t i = 0; i < documents.size(); ++i) {
+        if (documents[i]->HasParseError()) {
+          report(segment, begin + i, true);
+          std::cerr << "Malformed BMP message: "
+                    << std::string(data + lines[begin + i].first,
+                                   std::min<std::size_t>(
+                                       lines[begin + i].second, 80))
+                    << std::endl;
+          return EXIT_FAILURE;
+        }
+        process(*documents[i]);
+        ++m_number_of_processed_messages;
+      }
+      report(segment, end, false);
+    }
+    if (segment.is_last) {
+      report(segment, n, true);
+      return EXIT_SUCCESS;
+    }
+  }
+}
+
+/// Loads a TABLE_DUMP_V2 RIB snapshot with one bulk insert per source;
+/// routes of peers, or to next hops, that are not in the rDNS map are
+/// skipped
+int load_mrt(FILE *file, const string_to_nid_t &ip_to_nid,
+             nopticon::analysis_t &analysis, log_t &log) {
   assert(file != nullptr);
+  constexpr nopticon::nid_t UNKNOWN =
+      std::numeric_limits<nopticon::nid_t>::max();
+  nopticon::mrt_reader_t reader{file};
+  nopticon::mrt_routes_t mrt_routes;
+  std::vector<nopticon::nid_t> peer_to_nid;
+  std::vector<nopticon::routes_t> routes_per_source;
+  std::size_t number_of_routes = 0, number_of_skipped_routes = 0;
+  nopticon::timestamp_t timestamp = 0;
+  while (reader.read(mrt_routes)) {
+    timestamp = reader.timestamp() * MILLISECONDS_PER_SECOND;
+    if (peer_to_nid.size() != reader.peers().size()) {
+      peer_to_nid.clear();
+      for (auto &peer : reader.peers()) {
+        auto iter = ip_to_nid.find(ipv4_format(peer.bgp_id));
+        peer_to_nid.push_back(iter == ip_to_nid.end() ? UNKNOWN
+                                                      : iter->second);
+      }
+    }
+    for (auto &mrt_route : mrt_routes) {
+      auto source = peer_to_nid.at(mrt_route.peer_index);
+      auto target_iter = ip_to_nid.find(ipv4_format(mrt_route.next_hop));
+      if (source == UNKNOWN or target_iter == ip_to_nid.end()) {
+        ++number_of_skipped_routes;
+        continue;
+      }
+      if (source >= routes_per_source.size()) {
+        routes_per_source.resize(source + 1);
+      }
+      routes_per_source[source].emplace_back(
+          mrt_route.ip_prefix, nopticon::target_t{target_iter->second});
+      ++number_of_routes;
+    }
+  }
+  if (not reader.error().empty()) {
+    std::cerr << "MRT file reading failed: " << reader.error() << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (nopticon::source_t source = 0; source < routes_per_source.size();
+       ++source) {
+    auto &routes = routes_per_source[source];
+    if (routes.empty()) {
+      continue;
+    }
+    nopticon::sort_routes(routes);
+    analysis.insert_or_assign(source, routes, timestamp);
+  }
+  log.print(analysis);
+  std::cerr << "MRT routes: " << number_of_routes << " loaded, "
+            << number_of_skipped_routes +
+                   reader.number_of_skipped_routes()
+            << " skipped" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+/// Messages are read from the replay, if any, or otherwise from the file
+int process_bmp_message(std::size_t number_of_nodes, FILE *file,
+                        replay_t *replay, const string_to_nid_t &ip_to_nid,
+                        log_t &log, control_t *control, schedule_t &schedule,
+                        const std::vector<nopticon::policy_t> &policies,
+                        bool opt_withdraw_on_peer_down, FILE *mrt_file) {
+  assert(file != nullptr or replay != nullptr);
   nopticon::analysis_t analysis{log.opt_reach_summary_spans(),
                                 number_of_nodes};
-  char read_buffer[std::numeric_limits<uint16_t>::max()];
-  rapidjson::FileReadStream input(file, read_buffer, sizeof(read_buffer));
-  rapidjson::Document document;
-  while (not document.ParseStream<rapidjson::kParseStopWhenDoneFlag>(input)
-                 .HasParseError()) {
+  for (auto &policy : policies) {
+    analysis.insert_policy(policy);
+  }
+  if (mrt_file != nullptr) {
+    auto status = load_mrt(mrt_file, ip_to_nid, analysis, log);
+    if (status) {
+      return status;
+    }
+  }
+  auto process_document = [&](const rapidjson::Document &document) {
+    if (control != nullptr) {
+      control->poll(analysis, log);
+    }
     if (document.HasMember("Command")) {
-      process_cmd(analysis, log, document);
-      continue;
+      process_cmd(analysis, log, document["Command"]);
+      return;
     }
     assert(document.HasMember("Header"));
     assert(document["Header"].HasMember("Type"));
@@ -466,8 +1483,34 @@ void process_bmp_message(std::size_t number_of_nodes, FILE *file,
 
     auto &header = document["Header"];
     auto header_type = header["Type"].GetInt();
+    if (document.HasMember("PeerHeader") and
+        document["PeerHeader"].HasMember("Timestamp")) {
+      auto timestamp = make_timestamp(document["PeerHeader"]["Timestamp"]);
+      if (timestamp != 0) {
+        if (control != nullptr) {
+          control->advance(analysis, log, timestamp);
+        }
+        schedule.advance(analysis, log, timestamp);
+        // BMP peer down and peer up messages, respectively
+        if (header_type == 2 or header_type == 3) {
+          schedule.peer_change(analysis, log, timestamp);
+        }
+      }
+    }
+    // BMP peer down message
+    if (header_type == 2 and opt_withdraw_on_peer_down) {
+      assert(document.HasMember("PeerHeader"));
+      assert(document["PeerHeader"].HasMember("PeerBGPID"));
+      assert(document["PeerHeader"].HasMember("Timestamp"));
+      auto &peer_header = document["PeerHeader"];
+      auto source = ip_to_nid.at(peer_header["PeerBGPID"].GetString());
+      auto timestamp = make_timestamp(peer_header["Timestamp"]);
+      if (analysis.erase_source(source, timestamp) != 0) {
+        log.print(analysis);
+      }
+    }
     if (header_type != 0) {
-      continue;
+      return;
     }
 
     assert(document.HasMember("PeerHeader"));
@@ -485,16 +1528,7 @@ void process_bmp_message(std::size_t number_of_nodes, FILE *file,
 
     auto &peer_header = document["PeerHeader"];
     auto peer_bgpid = peer_header["PeerBGPID"].GetString();
-    nopticon::timestamp_t timestamp;
-    if (peer_header["Timestamp"].IsUint64()) {
-      // Convert time in seconds and to time in milliseconds
-      timestamp = peer_header["Timestamp"].GetUint64() * MILLISECONDS_PER_SECOND;
-    } else {
-      // Convert time in seconds and nanoseconds to time in milliseconds
-      assert(peer_header["Timestamp"].IsDouble());
-      timestamp = static_cast<nopticon::timestamp_t>(
-          peer_header["Timestamp"].GetDouble() * MILLISECONDS_PER_SECOND);
-    }
+    auto timestamp = make_timestamp(peer_header["Timestamp"]);
     auto &body = document["Body"];
     auto &bgp_update = body["BGPUpdate"];
     auto &bgp_update_body = bgp_update["Body"];
@@ -513,14 +1547,19 @@ void process_bmp_message(std::size_t number_of_nodes, FILE *file,
     auto &nlri = bgp_update_body["NLRI"];
     assert(nlri.Empty() == next_hop.empty());
     auto source = ip_to_nid.at(peer_bgpid);
-    if (next_hop != "0.0.0.0") {
+    if (next_hop != "0.0.0.0" and not nlri.Empty()) {
+      // all prefixes of an update share the next hop, so they are
+      // inserted as one batch, and logged once
+      nopticon::target_t target{ip_to_nid.at(next_hop)};
+      nopticon::routes_t routes;
       for (auto &nlri_value : nlri.GetArray()) {
         assert(nlri_value.HasMember("prefix"));
         auto ip_prefix = make_ip_prefix(nlri_value["prefix"].GetString());
-        auto target = ip_to_nid.at(next_hop);
-        analysis.insert_or_assign(ip_prefix, source, {target}, timestamp);
-        log.print(analysis);
+        routes.emplace_back(ip_prefix, target);
       }
+      nopticon::sort_routes(routes);
+      analysis.insert_or_assign(source, routes, timestamp);
+      log.print(analysis);
     }
     auto &withdrawn_routes = bgp_update_body["WithdrawnRoutes"];
     assert(withdrawn_routes.Empty() != next_hop.empty());
@@ -530,7 +1569,24 @@ void process_bmp_message(std::size_t number_of_nodes, FILE *file,
       analysis.erase(ip_prefix, source, timestamp);
       log.print(analysis);
     }
+  };
+  int status = EXIT_SUCCESS;
+  if (replay != nullptr) {
+    status = replay->run(process_document);
+  } else {
+    char read_buffer[std::numeric_limits<uint16_t>::max()];
+    rapidjson::FileReadStream input(file, read_buffer, sizeof(read_buffer));
+    rapidjson::Document document;
+    while (not document.ParseStream<rapidjson::kParseStopWhenDoneFlag>(input)
+                   .HasParseError()) {
+      process_document(document);
+    }
+  }
+  if (control != nullptr) {
+    control->poll(analysis, log);
+    control->flush(analysis, log);
   }
+  return status;
 }
 
 static const char *const s_usage =
@@ -564,6 +1620,46 @@ static const char *const s_usage =
     "  \tPrint node identifiers in JSON output\n\n"
     "  --log FILE\n"
     "  \tOutput results to FILE instead of stdout\n\n"
+    "  --control FILE\n"
+    "  \tRead commands from FILE, typically a named pipe,\n"
+    "  \tone JSON object per line, in the same format as\n"
+    "  \tcommands inlined into the BMP stream, e.g.\n"
+    "  \t{\"Command\": {\"Opcode\": 0}}\n"
+    "  \tIf a command has an \"At\" field, it is applied\n"
+    "  \tonce the BMP stream reaches that time (seconds);\n"
+    "  \tcommands still pending at the end are applied then\n\n"
+    "  --replay FILE\n"
+    "  \tRead the BMP messages from FILE, one per line, instead\n"
+    "  \tof stdin. The file is memory-mapped and parsed in\n"
+    "  \tparallel, and the progress is reported on stderr.\n"
+    "  \tIt may be gzip-compressed; a file compressed by\n"
+    "  \tbgzip is also decompressed in parallel\n\n"
+    "  --mrt FILE\n"
+    "  \tStart from the IPv4 unicast routes in FILE, an MRT\n"
+    "  \tTABLE_DUMP_V2 RIB snapshot, whose peers and next\n"
+    "  \thops are mapped to routers by the rDNS file, before\n"
+    "  \treading the BMP stream\n\n"
+    "  --policies FILE\n"
+    "  \tMonitor the intents in FILE, a JSON object with a\n"
+    "  \t'policies' array as in test/data/ft4_policies.json,\n"
+    "  \tand log a 'policy-events' entry as soon as one of\n"
+    "  \tthem is violated or recovers. Besides 'reachability'\n"
+    "  \tand 'path-preference', a policy of type 'waypoint'\n"
+    "  \tlists in 'waypoints' the nodes that every path from\n"
+    "  \t'source' to 'target' must go through\n\n"
+    "  --refresh-every SECONDS\n"
+    "  --reset-every SECONDS\n"
+    "  --dump-every SECONDS\n"
+    "  \tRefresh or reset the network summary, or print\n"
+    "  \tthe log as with the PRINT_LOG command, whenever\n"
+    "  \tthe BMP timestamps cross a multiple of SECONDS\n\n"
+    "  --withdraw-on-peer-down\n"
+    "  \tOn every BMP peer down message, withdraw all the\n"
+    "  \troutes of that peer at once\n\n"
+    "  --on-peer-change ACTIONS\n"
+    "  \tOn every BMP peer up or peer down message, apply\n"
+    "  \tACTIONS, a comma-separated list of 'dump', 'reset'\n"
+    "  \tand 'refresh', in the given order\n\n"
     "  --reach-summary SPANS\n"
     "  \tAnalyze a history of data planes where\n"
     "  \tSPANS is a comma-separated list of durations,\n"
@@ -574,6 +1670,20 @@ static const char *const s_usage =
     "  \tonly those reachability properties whose\n"
     "  \tdifference in rank is greater than or equal\n"
     "  \tto DISTANCE, a value between 0.0 and 1.0\n\n"
+    "  --delta KEYFRAMES\n"
+    "  \tAt VERBOSITY 6 and higher, print only what has\n"
+    "  \tchanged about all flows since the last record,\n"
+    "  \texcept in every KEYFRAMES-th record, which is\n"
+    "  \tmarked as a keyframe and prints all flows as usual.\n"
+    "  \tChanges are printed as 'flows-delta' with links\n"
+    "  \tthat were added or changed and 'removed-links',\n"
+    "  \tand as 'reach-summary-delta' with 'edges' whose\n"
+    "  \tranks changed and 'removed-edges'\n\n"
+    "  --delta-epsilon DISTANCE\n"
+    "  \t(requires --delta KEYFRAMES option)\n"
+    "  \tPrint a changed rank only if it differs by at\n"
+    "  \tleast DISTANCE from the last printed one\n"
+    "  \t(default: 0.01)\n\n"
     "  --verbosity VERBOSITY\n"
     "  \tAdjust the details included in the log where\n"
     "  \tVERBOSITY (from low to high) is as follows:\n"
@@ -587,6 +1697,11 @@ static const char *const s_usage =
     "  \t    (requires --reach-summary SPANS option)\n"
     "  \t8 - ... and history of each inferred property\n";
 
+static const std::pair<const char *, cmd_t> s_periodic_cmd_options[] = {
+    {"--refresh-every", cmd_t::REFRESH_NETWORK_SUMMARY},
+    {"--reset-every", cmd_t::RESET_NETWORK_SUMMARY},
+    {"--dump-every", cmd_t::PRINT_LOG}};
+
 void print_usage() { std::cerr << s_usage; }
 
 void print_rdns_error() { std::cerr << "rDNS map is empty" << std::endl; }
@@ -602,10 +1717,18 @@ template <class T> std::string join(const std::vector<T> &vec) {
 int main(int argc, char **args) {
   const char *rdns_file_name = nullptr;
   const char *log_file_name = nullptr;
+  const char *control_file_name = nullptr;
+  const char *policies_file_name = nullptr;
+  const char *mrt_file_name = nullptr;
+  const char *replay_file_name = nullptr;
   bool opt_node_ids = false;
+  bool opt_withdraw_on_peer_down = false;
   float opt_rank_threshold = 0.0f;
+  unsigned opt_keyframe_interval = 0;
+  float opt_delta_epsilon = 0.01f;
   nopticon::spans_t opt_reach_summary_spans;
   unsigned opt_verbosity = 1;
+  schedule_t schedule;
   if (argc < 2) {
     print_usage();
     return EXIT_FAILURE;
@@ -618,6 +1741,18 @@ int main(int argc, char **args) {
     if (std::strcmp(args[i], "--log") == 0) {
       log_file_name = args[i + 1];
     }
+    if (std::strcmp(args[i], "--control") == 0) {
+      control_file_name = args[i + 1];
+    }
+    if (std::strcmp(args[i], "--policies") == 0) {
+      policies_file_name = args[i + 1];
+    }
+    if (std::strcmp(args[i], "--mrt") == 0) {
+      mrt_file_name = args[i + 1];
+    }
+    if (std::strcmp(args[i], "--replay") == 0) {
+      replay_file_name = args[i + 1];
+    }
     if (std::strcmp(args[i], "--verbosity") == 0) {
       std::stringstream sstream{args[i + 1]};
       sstream >> opt_verbosity;
@@ -625,6 +1760,52 @@ int main(int argc, char **args) {
     if (std::strcmp(args[i], "--node-ids") == 0) {
       opt_node_ids = true;
     }
+    if (std::strcmp(args[i], "--withdraw-on-peer-down") == 0) {
+      opt_withdraw_on_peer_down = true;
+    }
+    for (auto &periodic_cmd : s_periodic_cmd_options) {
+      if (std::strcmp(args[i], periodic_cmd.first) != 0) {
+        continue;
+      }
+      std::stringstream sstream{args[i + 1]};
+      nopticon::duration_t interval = 0;
+      sstream >> interval;
+      if (interval == 0) {
+        print_usage();
+        return EXIT_FAILURE;
+      }
+      schedule.every(periodic_cmd.second, interval * MILLISECONDS_PER_SECOND);
+    }
+    if (std::strcmp(args[i], "--on-peer-change") == 0) {
+      std::stringstream sstream{args[i + 1]};
+      std::string action;
+      while (std::getline(sstream, action, ',')) {
+        if (action == "dump") {
+          schedule.on_peer_change(cmd_t::PRINT_LOG);
+        } else if (action == "reset") {
+          schedule.on_peer_change(cmd_t::RESET_NETWORK_SUMMARY);
+        } else if (action == "refresh") {
+          schedule.on_peer_change(cmd_t::REFRESH_NETWORK_SUMMARY);
+        } else {
+          print_usage();
+          return EXIT_FAILURE;
+        }
+      }
+    }
+    if (std::strcmp(args[i], "--delta") == 0) {
+      std::stringstream sstream{args[i + 1]};
+      sstream >> opt_keyframe_interval;
+      if (opt_keyframe_interval == 0) {
+        print_usage();
+        return EXIT_FAILURE;
+      }
+    }
+    if (std::strcmp(args[i], "--delta-epsilon") == 0) {
+      std::stringstream sstream{args[i + 1]};
+      sstream >> opt_delta_epsilon;
+      assert(0.0f <= opt_delta_epsilon);
+      assert(opt_delta_epsilon <= 1.0f);
+    }
     if (std::strcmp(args[i], "--rank-threshold") == 0) {
       std::stringstream sstream{args[i + 1]};
       sstream >> opt_rank_threshold;
@@ -668,6 +1849,38 @@ int main(int argc, char **args) {
     return EXIT_FAILURE;
   }
 
+  std::vector<nopticon::policy_t> policies;
+  if (policies_file_name != nullptr) {
+    auto policies_file = std::fopen(policies_file_name, "r");
+    if (!policies_file) {
+      std::perror("Policies file opening failed");
+      return EXIT_FAILURE;
+    }
+    status = read_policies(policies_file, name_to_nid, policies);
+    fclose(policies_file);
+    if (status) {
+      return status;
+    }
+  }
+
+  std::unique_ptr<replay_t> replay;
+  if (replay_file_name != nullptr) {
+    replay.reset(new replay_t);
+    if (not replay->open(replay_file_name)) {
+      std::perror("Replay file opening failed");
+      return EXIT_FAILURE;
+    }
+  }
+
+  FILE *mrt_file = nullptr;
+  if (mrt_file_name != nullptr) {
+    mrt_file = std::fopen(mrt_file_name, "rb");
+    if (!mrt_file) {
+      std::perror("MRT file opening failed");
+      return EXIT_FAILURE;
+    }
+  }
+
   std::streambuf *log_buffer;
   std::ofstream log_of;
   if (log_file_name != nullptr) {
@@ -677,20 +1890,61 @@ int main(int argc, char **args) {
     log_buffer = std::cout.rdbuf();
   }
 
+  std::unique_ptr<control_t> control;
+  if (control_file_name != nullptr) {
+    // Do not block until the other end of a named pipe is opened
+    auto control_fd = open(control_file_name, O_RDONLY | O_NONBLOCK);
+    if (control_fd == -1) {
+      std::perror("Control file opening failed");
+      return EXIT_FAILURE;
+    }
+    control.reset(new control_t{control_fd});
+  }
+
   std::cerr << "Nopticon version: " NOPTICON_VERSION "\n"
             << "enable node ids: " << yes_or_not(opt_node_ids) << std::endl
             << "log file: "
             << (log_file_name == nullptr ? "stdout" : log_file_name)
             << std::endl
+            << "control file: "
+            << (control_file_name == nullptr ? "<none>" : control_file_name)
+            << std::endl
             << "network summary spans: "
             << (opt_reach_summary_spans.empty()
                     ? "<empty>"
                     : join(opt_reach_summary_spans))
             << std::endl
+            << "policies: " << policies.size() << std::endl
+            << "replay file: "
+            << (replay_file_name == nullptr ? "<stdin>" : replay_file_name)
+            << std::endl
+            << "MRT file: "
+            << (mrt_file_name == nullptr ? "<none>" : mrt_file_name)
+            << std::endl
             << "rank threshold: " << opt_rank_threshold << std::endl
+            << "delta keyframes: "
+            << (opt_keyframe_interval == 0
+                    ? "<none>"
+                    : std::to_string(opt_keyframe_interval))
+            << std::endl
+            << "scheduled commands: " << yes_or_not(not schedule.empty())
+            << std::endl
+            << "withdraw on peer down: "
+            << yes_or_not(opt_withdraw_on_peer_down) << std::endl
             << "verbosity level: " << opt_verbosity << std::endl;
-  log_t log{log_buffer,   nid_to_name,        opt_verbosity,
-            opt_node_ids, opt_rank_threshold, opt_reach_summary_spans};
-  process_bmp_message(nid_to_name.size(), stdin, ip_to_nid, log);
-  return EXIT_SUCCESS;
+  log_t log{log_buffer,
+            nid_to_name,
+            opt_verbosity,
+            opt_node_ids,
+            opt_rank_threshold,
+            opt_reach_summary_spans,
+            opt_keyframe_interval,
+            opt_delta_epsilon};
+  status = process_bmp_message(nid_to_name.size(), stdin, replay.get(),
+                               ip_to_nid, log, control.get(), schedule,
+                               policies, opt_withdraw_on_peer_down, mrt_file);
+  if (mrt_file != nullptr) {
+    fclose(mrt_file);
+  }
+  return status;
 }
@@ -29,6 +29,21 @@ class ReachSummary:
             return {}
         return self._edges[flow]
 
+    def apply_delta(self, delta_json):
+        delta = json.loads(delta_json)
+        if delta.get('keyframe', False):
+            self.__init__(delta_json, self._sigfigs)
+            return
+        for flow in delta.get('reach-summary-delta', []):
+            flow_prefix = ipaddress.ip_network(flow['flow'])
+            flow_edges = self._edges.setdefault(flow_prefix, {})
+            for edge_details in flow['edges']:
+                edge = (edge_details['source'], edge_details['target'])
+                flow_edges[edge] = edge_details
+            for edge_details in flow['removed-edges']:
+                edge = (edge_details['source'], edge_details['target'])
+                del flow_edges[edge]
+
     def get_edge_rank(self, flow, edge):
         if edge not in self.get_edges(flow):
             return None
@@ -57,6 +72,19 @@ class LinkSummary:
             return {}
         return self._links[flow]
 
+    def apply_delta(self, delta_json):
+        delta = json.loads(delta_json)
+        if delta.get('keyframe', False):
+            self.__init__(delta_json)
+            return
+        for flow in delta.get('flows-delta', []):
+            flow_prefix = ipaddress.ip_network(flow['flow'])
+            flow_links = self._links.setdefault(flow_prefix, {})
+            for link in flow['links']:
+                flow_links[link['source']] = link['target']
+            for source in flow['removed-links']:
+                del flow_links[source]
+
     def get_targets(self, flow, source):
         if source not in self.get_links(flow):
             return []
@@ -2,13 +2,14 @@
 // Use of this source code is governed by a LICENSE.
 
 #include "analysis.hh"
-#include <bitset>
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 
 namespace nopticon {
 
 void history_t::refresh(timestamp_t timestamp) noexcept {
+  m_is_ranks_valid = false;
   // If we're in 'stop', then set tail to new start;
   // otherwise, cause tail to catch up with head.
   bool is_stop = m_head & 1;
@@ -62,6 +63,7 @@ void history_t::update_duration(bool is_stop, timestamp_t current) {
     return;
   }
   m_time_window.at(m_head = index(m_head + 1)) = current;
+  m_is_ranks_valid = false;
   if (is_stop) {
     assert(m_head & 1); // current head is a start idx, expecting a stop
     auto next_head = index(m_head + 1);
@@ -129,6 +131,7 @@ timestamps_t history_t::timestamps(timestamp_t global_end) const noexcept {
 }
 
 void history_t::reset() noexcept {
+  m_is_ranks_valid = false;
   m_head = m_time_window.size() - 1;
   for (auto &slice : m_slices) {
     slice.duration = 0;
@@ -148,34 +151,47 @@ reach_summary_t::reach_summary_t(const spans_t &spans,
 }
 
 void reach_summary_t::reset() noexcept {
-  for (auto &history_vec : m_tensor) {
-    for (auto &history : history_vec) {
-      history.reset();
+  // histories that have never been started are already in reset state
+  for (std::size_t flow_id = 0; flow_id < m_started.size(); ++flow_id) {
+    for (auto index : m_started[flow_id]) {
+      m_tensor[flow_id][index].reset();
     }
   }
+  rebuild_rank_index();
 }
 
 void reach_summary_t::refresh(timestamp_t timestamp) noexcept {
-  if (global_start < timestamp) {
-    global_start = timestamp;
-  }
   if (global_stop < timestamp) {
     global_stop = timestamp;
   }
+  // global_start is still unset if nothing has been analyzed yet
+  if (global_start < timestamp or global_stop < global_start) {
+    global_start = timestamp;
+  }
   assert(global_start <= global_stop);
-  for (auto &history_vec : m_tensor) {
-    for (auto &history : history_vec) {
-      history.refresh(timestamp);
+  // refreshing a history that has never been started is a no-op
+  for (std::size_t flow_id = 0; flow_id < m_started.size(); ++flow_id) {
+    for (auto index : m_started[flow_id]) {
+      m_tensor[flow_id][index].refresh(timestamp);
     }
   }
+  rebuild_rank_index();
 }
 
-ranks_t reach_summary_t::ranks(const history_t &history) const {
-  ranks_t ranks;
+const ranks_t &reach_summary_t::ranks(const history_t &history) const {
+  if (history.m_is_ranks_valid and history.m_ranks_start == global_start and
+      history.m_ranks_stop == global_stop) {
+    return history.m_ranks;
+  }
+  auto &ranks = history.m_ranks;
+  ranks.clear();
   ranks.reserve(history.slices().size());
   for (auto &slice : history.slices()) {
     ranks.push_back(history.rank(slice, global_start, global_stop));
   }
+  history.m_ranks_start = global_start;
+  history.m_ranks_stop = global_stop;
+  history.m_is_ranks_valid = true;
   return ranks;
 }
 
@@ -197,6 +213,7 @@ history_vec_t &reach_summary_t::history_vec(flow_id_t flow_id) {
   if (flow_id >= m_tensor.size()) {
     auto old_size = m_tensor.size();
     m_tensor.resize((flow_id + 1) << 1);
+    m_started.resize(m_tensor.size());
     for (std::size_t i = old_size; i < m_tensor.size(); ++i) {
       assert(m_tensor[i].empty());
       history_t history{spans};
@@ -221,6 +238,13 @@ const history_t &reach_summary_t::history(flow_id_t flow_id, nid_t s,
   return history_vec[index];
 }
 
+const history_t &reach_summary_t::history(flow_id_t flow_id,
+                                          std::size_t index) const {
+  assert(flow_id < m_tensor.size());
+  assert(index < m_tensor[flow_id].size());
+  return m_tensor[flow_id][index];
+}
+
 history_t &reach_summary_t::history(flow_id_t flow_id, nid_t s, nid_t t) {
   auto &hv = history_vec(flow_id);
   auto index = make_index(s, t);
@@ -228,49 +252,147 @@ history_t &reach_summary_t::history(flow_id_t flow_id, nid_t s, nid_t t) {
   return hv[index];
 }
 
-void find_loops(source_t start, const affected_flows_t &affected_flows,
-                loops_per_flow_t &loops_per_flow) {
-  ip_addr_vec_t stack, path;
-  std::unordered_set<source_t> seen;
-  for (auto flow : affected_flows) {
-    assert(stack.empty());
-    assert(seen.empty());
-    assert(path.empty());
-
-    auto &rule_ref_per_source = flow->data;
-    stack.reserve(rule_ref_per_source.size() + 1);
-    path.reserve(rule_ref_per_source.size() + 1);
-    stack.push_back(start);
-    while (not stack.empty()) {
-      auto n = stack.back();
-      stack.pop_back();
-      auto rule_ref_per_source_iter = rule_ref_per_source.find(n);
-      if (rule_ref_per_source_iter == rule_ref_per_source.end()) {
-        if (path.empty()) {
-          assert(stack.empty());
-          break;
-        }
-        path.pop_back();
-        continue;
-      }
-      auto rule_ref = rule_ref_per_source_iter->second;
-      auto insert_result = seen.insert(n);
-      if (not nopticon::ok(insert_result)) {
-        assert(not path.empty());
-        auto min_iter = std::min_element(path.begin(), path.end());
-        std::rotate(path.begin(), min_iter, path.end());
-        loops_per_flow[flow].push_back(std::move(path));
-        path = ip_addr_vec_t();
-        stack.clear();
-        break;
-      }
-      path.push_back(n);
-      stack.insert(stack.end(), rule_ref->target.begin(),
-                   rule_ref->target.end());
+history_t &reach_summary_t::start(flow_id_t flow_id, nid_t s, nid_t t,
+                                  timestamp_t timestamp) {
+  auto &hv = history_vec(flow_id);
+  auto index = make_index(s, t);
+  assert(index < hv.size());
+  auto &started = m_started[flow_id];
+  auto iter = std::lower_bound(started.begin(), started.end(), index);
+  if (iter == started.end() or *iter != index) {
+    started.insert(iter, index);
+  }
+  auto &history = hv[index];
+  history.start(timestamp);
+  update_rank_index(flow_id, index, history);
+  return history;
+}
+
+void reach_summary_t::stop(flow_id_t flow_id, std::size_t index,
+                           timestamp_t timestamp) {
+  assert(flow_id < m_tensor.size());
+  assert(index < m_tensor[flow_id].size());
+  auto &history = m_tensor[flow_id][index];
+  history.stop(timestamp);
+  update_rank_index(flow_id, index, history);
+}
+
+void reach_summary_t::update_rank_index(flow_id_t flow_id, std::size_t index,
+                                        history_t &history) {
+  if (spans.empty() or source(index) == target(index)) {
+    return;
+  }
+  bool is_open = !(history.m_head & 1);
+  int64_t key = history.m_slices.front().duration;
+  if (is_open) {
+    key -= history.newest_time();
+  }
+  if (history.m_is_rank_indexed) {
+    if (history.m_is_rank_open == is_open and history.m_rank_key == key) {
+      return;
+    }
+    auto &ranks = history.m_is_rank_open ? m_open_ranks : m_closed_ranks;
+    auto ok = ranks.erase({history.m_rank_key, handle(flow_id, index)});
+    assert(ok);
+  }
+  auto &ranks = is_open ? m_open_ranks : m_closed_ranks;
+  auto ok = ranks.insert({key, handle(flow_id, index)});
+  assert(ok);
+  history.m_rank_key = key;
+  history.m_is_rank_open = is_open;
+  history.m_is_rank_indexed = true;
+}
+
+void reach_summary_t::rebuild_rank_index() {
+  m_open_ranks.clear();
+  m_closed_ranks.clear();
+  for (std::size_t flow_id = 0; flow_id < m_started.size(); ++flow_id) {
+    for (auto index : m_started[flow_id]) {
+      auto &history = m_tensor[flow_id][index];
+      history.m_is_rank_indexed = false;
+      update_rank_index(flow_id, index, history);
+    }
+  }
+}
+
+ranked_reach_t reach_summary_t::make_ranked_reach(uint64_t handle) const {
+  auto size = number_of_nodes * number_of_nodes;
+  flow_id_t flow_id = handle / size;
+  std::size_t index = handle % size;
+  return {flow_id, source(index), target(index),
+          ranks(history(flow_id, index)).front()};
+}
+
+ranked_reaches_t reach_summary_t::top_k(std::size_t k) const {
+  ranked_reaches_t ranked_reaches;
+  auto closed_size = m_closed_ranks.size();
+  auto open_size = m_open_ranks.size();
+  const int64_t stop = global_stop;
+  while (ranked_reaches.size() < k and (closed_size != 0 or open_size != 0)) {
+    // an open history wins a tie because its rank includes a boost
+    bool is_open = closed_size == 0 or
+                   (open_size != 0 and
+                    m_closed_ranks.at(closed_size - 1).first <=
+                        m_open_ranks.at(open_size - 1).first + stop);
+    auto &key = is_open ? m_open_ranks.at(--open_size)
+                        : m_closed_ranks.at(--closed_size);
+    ranked_reaches.push_back(make_ranked_reach(key.second));
+  }
+  return ranked_reaches;
+}
+
+ranked_reaches_t reach_summary_t::top_k(flow_id_t flow_id,
+                                        std::size_t k) const {
+  ranked_reaches_t ranked_reaches;
+  if (spans.empty()) {
+    return ranked_reaches;
+  }
+  for (auto index : started(flow_id)) {
+    if (source(index) != target(index)) {
+      ranked_reaches.push_back({flow_id, source(index), target(index),
+                                ranks(history(flow_id, index)).front()});
     }
-    seen.clear();
-    path.clear();
   }
+  auto middle = ranked_reaches.begin() + std::min(k, ranked_reaches.size());
+  std::partial_sort(ranked_reaches.begin(), middle, ranked_reaches.end(),
+                    [](const ranked_reach_t &a, const ranked_reach_t &b) {
+                      return a.rank > b.rank;
+                    });
+  ranked_reaches.erase(middle, ranked_reaches.end());
+  return ranked_reaches;
+}
+
+double reach_summary_t::percentile(flow_id_t flow_id, nid_t s,
+                                   nid_t t) const {
+  auto total = m_closed_ranks.size() + m_open_ranks.size();
+  if (flow_id >= m_tensor.size() or total == 0) {
+    return 0.0;
+  }
+  auto &history = m_tensor[flow_id][make_index(s, t)];
+  if (not history.m_is_rank_indexed) {
+    return 0.0;
+  }
+  const int64_t stop = global_stop;
+  std::size_t count;
+  if (history.m_is_rank_open) {
+    auto duration = history.m_rank_key + stop;
+    count = m_closed_ranks.count_less({duration + 1, 0}) +
+            m_open_ranks.count_less({history.m_rank_key + 1, 0});
+  } else {
+    auto duration = history.m_rank_key;
+    count = m_closed_ranks.count_less({duration + 1, 0}) +
+            m_open_ranks.count_less({duration - stop, 0});
+  }
+  return 100.0 * count / total;
+}
+
+const std::vector<std::size_t> &
+reach_summary_t::started(flow_id_t flow_id) const {
+  static const std::vector<std::size_t> s_empty_started;
+  if (flow_id >= m_started.size()) {
+    return s_empty_started;
+  }
+  return m_started[flow_id];
 }
 
 static bool is_connected(const rule_ref_per_source_t &rule_ref_per_source,
@@ -298,74 +420,60 @@ bool check_loop(const_flow_t flow, const loop_t &loop) {
   return is_connected(rule_ref_per_source, loop.back(), loop.front());
 }
 
-void analysis_t::clean_up() {
-  for (auto flow : m_affected_flows) {
-    auto loops_per_flow_iter = m_loops_per_flow.find(flow);
-    if (loops_per_flow_iter == m_loops_per_flow.end()) {
-      continue;
+void analysis_t::check_affected_flows(timestamp_t timestamp) {
+  if (timestamp != 0) {
+    if (timestamp < m_reach_summary.global_start) {
+      m_reach_summary.global_start = timestamp;
     }
-    loops_t loops;
-    for (auto &loop : loops_per_flow_iter->second) {
-      if (check_loop(flow, loop)) {
-        loops.push_back(std::move(loop));
-      }
+    if (m_reach_summary.global_stop < timestamp) {
+      m_reach_summary.global_stop = timestamp;
+    }
+  }
+
+  // flows that forward alike are consecutive, so each equivalence class
+  // is checked only once
+  m_flows_by_class.assign(m_affected_flows.begin(), m_affected_flows.end());
+  std::sort(m_flows_by_class.begin(), m_flows_by_class.end(),
+            [this](const_flow_t x, const_flow_t y) {
+              auto x_hash = m_flow_graph.forwarding_hash(x);
+              auto y_hash = m_flow_graph.forwarding_hash(y);
+              return x_hash == y_hash ? x->id < y->id : x_hash < y_hash;
+            });
+  bool is_checked = false;
+  uint64_t checked_hash = 0;
+  for (auto flow : m_flows_by_class) {
+    auto hash = m_flow_graph.forwarding_hash(flow);
+    if (not is_checked or hash != checked_hash) {
+      m_flow_check.check(flow);
+      is_checked = true;
+      checked_hash = hash;
     }
-    if (loops.empty()) {
+    if (m_flow_check.loops().empty()) {
       m_loops_per_flow.erase(flow);
     } else {
-      m_loops_per_flow[flow] = std::move(loops);
+      m_loops_per_flow[flow] = m_flow_check.loops();
+    }
+    if (m_flow_check.blackholes().empty()) {
+      m_blackholes_per_flow.erase(flow);
+    } else {
+      m_blackholes_per_flow[flow] = m_flow_check.blackholes();
+    }
+    if (timestamp == 0) {
+      continue;
     }
-  }
-}
-
-void analysis_t::update_reach_summary(timestamp_t timestamp) {
-  ip_addr_vec_t stack;
-  std::bitset<MAX_NUMBER_OF_NODES> bitset;
-  stack.reserve(m_reach_summary.number_of_nodes);
-
-  if (timestamp < m_reach_summary.global_start) {
-    m_reach_summary.global_start = timestamp;
-  }
-  if (m_reach_summary.global_stop < timestamp) {
-    m_reach_summary.global_stop = timestamp;
-  }
 
-  for (auto flow : m_affected_flows) {
-    assert(stack.empty());
-    auto &history_vec = m_reach_summary.history_vec(flow->id);
-    auto &rule_ref_per_source = flow->data;
-    for (auto &kv : rule_ref_per_source) {
-      assert(stack.empty());
-      auto start = kv.first;
-      auto base_index = m_reach_summary.number_of_nodes * start;
-      stack.push_back(start);
-      while (not stack.empty()) {
-        auto n = stack.back();
-        stack.pop_back();
-        auto rule_ref_per_source_iter = rule_ref_per_source.find(n);
-        if (rule_ref_per_source_iter == rule_ref_per_source.end()) {
-          continue;
-        }
-        auto rule_ref = rule_ref_per_source_iter->second;
-        for (auto t : rule_ref->target) {
-          auto index = base_index + t;
-          assert(index < history_vec.size());
-          if (bitset.test(t)) {
-            continue;
-          }
-          auto &history = history_vec[index];
-          history.start(timestamp);
-          history.request_stop = false;
-          bitset.set(t);
-          stack.push_back(t);
-        }
-      }
-      bitset.reset();
+    for (auto s : m_flow_check.sources()) {
+      m_flow_check.for_each_reachable(s, [&](nid_t t) {
+        m_reach_summary.start(flow->id, s, t, timestamp).request_stop = false;
+      });
     }
-    for (auto &history : history_vec) {
+    // histories that have never been started cannot be stopped
+    auto &history_vec = m_reach_summary.history_vec(flow->id);
+    for (auto index : m_reach_summary.started(flow->id)) {
+      auto &history = history_vec[index];
       // stop requests for histories that just got started are no-ops
       if (history.request_stop) {
-        history.stop(timestamp);
+        m_reach_summary.stop(flow->id, index, timestamp);
       }
       history.request_stop = true;
     }
@@ -378,26 +486,39 @@ bool analysis_t::insert_or_assign(const ip_prefix_t &ip_prefix, source_t source,
   m_affected_flows.clear();
   bool status = m_flow_graph.insert_or_assign(ip_prefix, source, new_target,
                                               m_affected_flows);
-  clean_up();
-  find_loops(source, m_affected_flows, m_loops_per_flow);
-  if (timestamp != 0) {
-    update_reach_summary(timestamp);
-  }
+  check_affected_flows(timestamp);
+  m_policy_monitor.update(m_affected_flows);
   return status;
 }
 
+std::size_t analysis_t::insert_or_assign(source_t source,
+                                         const routes_t &routes,
+                                         timestamp_t timestamp) {
+  m_affected_flows.clear();
+  auto number_of_rules =
+      m_flow_graph.insert_or_assign(source, routes, m_affected_flows);
+  check_affected_flows(timestamp);
+  m_policy_monitor.update(m_affected_flows);
+  return number_of_rules;
+}
+
 bool analysis_t::erase(const ip_prefix_t &ip_prefix, source_t source,
                        timestamp_t timestamp) {
   m_affected_flows.clear();
   bool status = m_flow_graph.erase(ip_prefix, source, m_affected_flows);
-  clean_up();
-  find_loops(source, m_affected_flows, m_loops_per_flow);
-  if (timestamp != 0) {
-    update_reach_summary(timestamp);
-  }
+  check_affected_flows(timestamp);
+  m_policy_monitor.update(m_affected_flows);
   return status;
 }
 
+std::size_t analysis_t::erase_source(source_t source, timestamp_t timestamp) {
+  m_affected_flows.clear();
+  auto number_of_rules = m_flow_graph.erase_source(source, m_affected_flows);
+  check_affected_flows(timestamp);
+  m_policy_monitor.update(m_affected_flows);
+  return number_of_rules;
+}
+
 timestamps_t intersect(const timestamps_t &a, const timestamps_t &b) {
   if (a.empty() or b.empty()) {
     return {};
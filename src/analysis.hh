@@ -3,15 +3,16 @@
 
 #pragma once
 
+#include "flow_check.hh"
 #include "flow_graph.hh"
+#include "order_statistic_tree.hh"
+#include "policy.hh"
 
 namespace nopticon {
 
-typedef std::vector<nid_t> loop_t;
-typedef std::vector<loop_t> loops_t;
 typedef std::unordered_map<const_flow_t, loops_t> loops_per_flow_t;
-
-void find_loops(source_t, const affected_flows_t &, loops_per_flow_t &);
+typedef std::unordered_map<const_flow_t, std::vector<nid_t>>
+    blackholes_per_flow_t;
 
 bool check_loop(const_flow_t, const loop_t &);
 
@@ -109,10 +110,30 @@ private:
   timestamps_t m_time_window;
   std::size_t m_head;
   slices_t m_slices;
+
+  // ranks for the global time window in which they were computed
+  mutable ranks_t m_ranks;
+  mutable timestamp_t m_ranks_start = 0, m_ranks_stop = 0;
+  mutable bool m_is_ranks_valid = false;
+
+  // position in the rank index of the reach summary, if any
+  int64_t m_rank_key = 0;
+  bool m_is_rank_open = false;
+  bool m_is_rank_indexed = false;
 };
 
 typedef std::vector<history_t> history_vec_t;
 
+/// Reachability property of a flow and the rank of its shortest slice
+struct ranked_reach_t {
+  flow_id_t flow_id;
+  nid_t source;
+  nid_t target;
+  rank_t rank;
+};
+
+typedef std::vector<ranked_reach_t> ranked_reaches_t;
+
 class reach_summary_t {
 public:
   const spans_t spans;
@@ -129,20 +150,65 @@ public:
   const slices_t &slices(flow_id_t, nid_t, nid_t) const;
 
   const history_t &history(flow_id_t, nid_t, nid_t) const;
+  const history_t &history(flow_id_t, std::size_t index) const;
 
-  /// For each slice, normalized duration in which a property held
-  ranks_t ranks(const history_t &) const;
+  /// For each slice, normalized duration in which a property held;
+  /// only recomputed if the history or global time window changed
+  const ranks_t &ranks(const history_t &) const;
 
   history_vec_t &history_vec(flow_id_t);
   history_t &history(flow_id_t, nid_t, nid_t);
 
+  /// Start the history of whether t is reachable from s in the flow
+  history_t &start(flow_id_t, nid_t s, nid_t t, timestamp_t);
+
+  /// Stop the history at the given index of `started()`
+  void stop(flow_id_t, std::size_t index, timestamp_t);
+
+  /// At most k properties with the highest rank of the shortest slice,
+  /// in decreasing order of rank, across all flows
+  ranked_reaches_t top_k(std::size_t k) const;
+
+  /// At most k properties of the flow with the highest rank of the
+  /// shortest slice, in decreasing order of rank
+  ranked_reaches_t top_k(flow_id_t, std::size_t k) const;
+
+  /// Percentage of started properties, across all flows, whose rank
+  /// of the shortest slice is at most that of the given property
+  double percentile(flow_id_t, nid_t s, nid_t t) const;
+
+  /// Index, in increasing order, of each history in the flow that has
+  /// been started through `start()`; all other histories are empty
+  const std::vector<std::size_t> &started(flow_id_t) const;
+
+  nid_t source(std::size_t index) const { return index / number_of_nodes; }
+  nid_t target(std::size_t index) const { return index % number_of_nodes; }
+
 private:
   typedef std::vector<history_vec_t> tensor_t;
   tensor_t m_tensor;
+  std::vector<std::vector<std::size_t>> m_started;
+
+  // Histories with s != t ordered by the duration of their shortest
+  // slice; this orders them by rank because all of them share the same
+  // global time window. Keys of open histories exclude the time since
+  // their newest start, which would otherwise change with global_stop.
+  typedef std::pair<int64_t, uint64_t> rank_key_t;
+  order_statistic_tree_t<rank_key_t> m_closed_ranks;
+  order_statistic_tree_t<rank_key_t> m_open_ranks;
 
   inline std::size_t make_index(nid_t s, nid_t t) const {
     return number_of_nodes * s + t;
   }
+
+  inline uint64_t handle(flow_id_t flow_id, std::size_t index) const {
+    return static_cast<uint64_t>(flow_id) * number_of_nodes * number_of_nodes +
+           index;
+  }
+
+  void update_rank_index(flow_id_t, std::size_t index, history_t &);
+  void rebuild_rank_index();
+  ranked_reach_t make_ranked_reach(uint64_t handle) const;
 };
 
 class analysis_t {
@@ -150,18 +216,31 @@ public:
   constexpr static std::size_t MAX_NUMBER_OF_NODES = 4096;
 
   analysis_t(std::size_t number_of_nodes)
-      : m_reach_summary{spans_t{}, number_of_nodes} {}
+      : m_reach_summary{spans_t{}, number_of_nodes},
+        m_policy_monitor{number_of_nodes}, m_flow_check{number_of_nodes} {}
 
   analysis_t(const spans_t &spans, std::size_t number_of_nodes)
-      : m_reach_summary{spans, number_of_nodes} {}
+      : m_reach_summary{spans, number_of_nodes},
+        m_policy_monitor{number_of_nodes}, m_flow_check{number_of_nodes} {}
 
   /// Returns true when a new rule has been created; false otherwise
   bool insert_or_assign(const ip_prefix_t &, source_t, const target_t &,
                         timestamp_t current = 0);
 
+  /// Inserts or assigns a batch of routes of the source, strictly sorted
+  /// in IP prefix order, and checks the affected flows once; returns the
+  /// number of new rules
+  std::size_t insert_or_assign(source_t, const routes_t &,
+                               timestamp_t current = 0);
+
   /// Returns true if the rule existed; false otherwise
   bool erase(const ip_prefix_t &, source_t, timestamp_t current = 0);
 
+  /// Erases every rule of the source, such as when its BGP session goes
+  /// down, and checks the affected flows once; returns the number of
+  /// erased rules
+  std::size_t erase_source(source_t, timestamp_t current = 0);
+
   bool ok() const noexcept { return m_loops_per_flow.empty(); }
 
   const flow_graph_t &flow_graph() const noexcept { return m_flow_graph; }
@@ -180,18 +259,44 @@ public:
     return m_loops_per_flow;
   }
 
+  /// Next hops without a rule, for each flow that has such next hops
+  const blackholes_per_flow_t &blackholes_per_flow() const noexcept {
+    return m_blackholes_per_flow;
+  }
+
+  /// Loops, blackholes and reachability of the flow; the result is only
+  /// valid until the next call or update
+  const flow_check_t &check(const_flow_t flow) const {
+    m_flow_check.check(flow);
+    return m_flow_check;
+  }
+
   const affected_flows_t &affected_flows() const noexcept {
     return m_affected_flows;
   }
 
+  /// Subsequent updates report whenever the policy stops or starts to hold
+  policy_id_t insert_policy(const policy_t &policy) {
+    return m_policy_monitor.insert(policy, m_flow_graph);
+  }
+
+  const policy_monitor_t &policy_monitor() const noexcept {
+    return m_policy_monitor;
+  }
+
 private:
-  void clean_up();
-  void update_reach_summary(timestamp_t);
+  /// Checks each equivalence class of the affected flows once for loops,
+  /// blackholes and, unless the timestamp is zero, reachability
+  void check_affected_flows(timestamp_t);
 
   flow_graph_t m_flow_graph;
   affected_flows_t m_affected_flows;
+  affected_flows_t m_flows_by_class;
   loops_per_flow_t m_loops_per_flow;
+  blackholes_per_flow_t m_blackholes_per_flow;
   reach_summary_t m_reach_summary;
+  policy_monitor_t m_policy_monitor;
+  mutable flow_check_t m_flow_check;
 };
 
 timestamps_t intersect(const timestamps_t &, const timestamps_t &);
@@ -0,0 +1,233 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "ecmp.hh"
+
+#include <algorithm>
+
+namespace nopticon {
+
+typedef std::vector<std::vector<uint32_t>> adjacency_t;
+
+/// Nodes that have a rule for the flow, in increasing order, and the
+/// edges between them; nodes without a rule cannot be part of a cycle
+static void make_graph(const_flow_t flow, std::vector<nid_t> &nodes,
+                       adjacency_t &adjacency) {
+  auto &rule_ref_per_source = flow->data;
+  nodes.reserve(rule_ref_per_source.size());
+  for (auto &kv : rule_ref_per_source) {
+    nodes.push_back(kv.first);
+  }
+  std::sort(nodes.begin(), nodes.end());
+  std::unordered_map<nid_t, uint32_t> index;
+  for (uint32_t i = 0; i < nodes.size(); ++i) {
+    index.emplace(nodes[i], i);
+  }
+  adjacency.resize(nodes.size());
+  for (uint32_t i = 0; i < nodes.size(); ++i) {
+    auto &successors = adjacency[i];
+    for (auto t : rule_ref_per_source.at(nodes[i])->target) {
+      auto index_iter = index.find(t);
+      if (index_iter != index.end()) {
+        successors.push_back(index_iter->second);
+      }
+    }
+    std::sort(successors.begin(), successors.end());
+    successors.erase(std::unique(successors.begin(), successors.end()),
+                     successors.end());
+  }
+}
+
+/// Enumerates the elementary cycles through each node s that only go
+/// through nodes greater than s, so every cycle is found exactly once
+class johnson_t {
+public:
+  johnson_t(const std::vector<nid_t> &nodes, const adjacency_t &adjacency,
+            std::size_t max_cycles, loops_t &cycles)
+      : m_nodes(nodes), m_adjacency(adjacency),
+        m_predecessors(nodes.size()), m_max_cycles(max_cycles),
+        m_cycles(cycles), m_is_blocked(nodes.size()),
+        m_blocked_by(nodes.size()), m_is_reached(nodes.size()),
+        m_is_in_component(nodes.size()) {
+    for (uint32_t v = 0; v < nodes.size(); ++v) {
+      for (auto w : adjacency[v]) {
+        m_predecessors[w].push_back(v);
+      }
+    }
+  }
+
+  void run() {
+    for (m_s = 0; m_s < m_nodes.size() and not is_done(); ++m_s) {
+      find_component();
+      if (not m_is_in_component[m_s]) {
+        continue;
+      }
+      std::fill(m_is_blocked.begin(), m_is_blocked.end(), false);
+      for (auto &blocked_by : m_blocked_by) {
+        blocked_by.clear();
+      }
+      circuit(m_s);
+    }
+  }
+
+private:
+  const std::vector<nid_t> &m_nodes;
+  const adjacency_t &m_adjacency;
+  adjacency_t m_predecessors;
+  const std::size_t m_max_cycles;
+  loops_t &m_cycles;
+
+  uint32_t m_s;
+  loop_t m_path;
+  std::vector<bool> m_is_blocked;
+  adjacency_t m_blocked_by;
+
+  // scratch space to find the strongly connected component of s
+  std::vector<bool> m_is_reached, m_is_in_component;
+  std::vector<uint32_t> m_stack;
+
+  bool is_done() const noexcept { return m_cycles.size() >= m_max_cycles; }
+
+  /// Nodes greater or equal to s that reach s and are reachable from s
+  void find_component() {
+    std::fill(m_is_reached.begin(), m_is_reached.end(), false);
+    std::fill(m_is_in_component.begin(), m_is_in_component.end(), false);
+    m_stack.push_back(m_s);
+    while (not m_stack.empty()) {
+      auto v = m_stack.back();
+      m_stack.pop_back();
+      for (auto w : m_adjacency[v]) {
+        if (m_s <= w and not m_is_reached[w]) {
+          m_is_reached[w] = true;
+          m_stack.push_back(w);
+        }
+      }
+    }
+    if (not m_is_reached[m_s]) {
+      return;
+    }
+    m_is_in_component[m_s] = true;
+    m_stack.push_back(m_s);
+    while (not m_stack.empty()) {
+      auto v = m_stack.back();
+      m_stack.pop_back();
+      for (auto u : m_predecessors[v]) {
+        if (m_is_reached[u] and not m_is_in_component[u]) {
+          m_is_in_component[u] = true;
+          m_stack.push_back(u);
+        }
+      }
+    }
+  }
+
+  void unblock(uint32_t u) {
+    m_is_blocked[u] = false;
+    auto blocked_by = std::move(m_blocked_by[u]);
+    m_blocked_by[u].clear();
+    for (auto w : blocked_by) {
+      if (m_is_blocked[w]) {
+        unblock(w);
+      }
+    }
+  }
+
+  /// Returns true if a cycle has been found through v
+  bool circuit(uint32_t v) {
+    bool is_found = false;
+    m_path.push_back(m_nodes[v]);
+    m_is_blocked[v] = true;
+    for (auto w : m_adjacency[v]) {
+      if (is_done()) {
+        break;
+      }
+      if (not m_is_in_component[w]) {
+        continue;
+      }
+      if (w == m_s) {
+        m_cycles.push_back(m_path);
+        is_found = true;
+      } else if (not m_is_blocked[w] and circuit(w)) {
+        is_found = true;
+      }
+    }
+    if (is_found) {
+      unblock(v);
+    } else {
+      for (auto w : m_adjacency[v]) {
+        auto &blocked_by = m_blocked_by[w];
+        if (m_is_in_component[w] and
+            std::find(blocked_by.begin(), blocked_by.end(), v) ==
+                blocked_by.end()) {
+          blocked_by.push_back(v);
+        }
+      }
+    }
+    m_path.pop_back();
+    return is_found;
+  }
+};
+
+loops_t find_cycles(const_flow_t flow, std::size_t max_cycles) {
+  std::vector<nid_t> nodes;
+  adjacency_t adjacency;
+  make_graph(flow, nodes, adjacency);
+  loops_t cycles;
+  johnson_t(nodes, adjacency, max_cycles, cycles).run();
+  return cycles;
+}
+
+bool count_paths(const_flow_t flow, source_t source, path_counts_t &counts) {
+  enum : uint8_t { WHITE = 0, GRAY, BLACK };
+  struct frame_t {
+    nid_t nid;
+    const next_hops_t *target;
+    std::size_t i;
+  };
+  static const next_hops_t s_no_target;
+  auto &rule_ref_per_source = flow->data;
+  auto find_target = [&](nid_t n) -> const next_hops_t * {
+    auto iter = rule_ref_per_source.find(n);
+    if (iter == rule_ref_per_source.end()) {
+      return &s_no_target;
+    }
+    return &iter->second->target;
+  };
+
+  // reverse topological order of the nodes reachable from the source
+  std::unordered_map<nid_t, uint8_t> color;
+  std::vector<frame_t> stack;
+  std::vector<frame_t> finished;
+  counts.clear();
+  color[source] = GRAY;
+  stack.push_back({source, find_target(source), 0});
+  while (not stack.empty()) {
+    auto &frame = stack.back();
+    if (frame.i == frame.target->size()) {
+      color[frame.nid] = BLACK;
+      finished.push_back(frame);
+      stack.pop_back();
+      continue;
+    }
+    auto t = (*frame.target)[frame.i++];
+    auto &t_color = color[t];
+    if (t_color == GRAY) {
+      return false;
+    }
+    if (t_color == WHITE) {
+      t_color = GRAY;
+      stack.push_back({t, find_target(t), 0});
+    }
+  }
+
+  counts[source] = 1;
+  for (auto iter = finished.rbegin(); iter != finished.rend(); ++iter) {
+    auto count = counts[iter->nid];
+    for (auto t : *iter->target) {
+      auto &t_count = counts[t];
+      t_count = UINT64_MAX - t_count < count ? UINT64_MAX : t_count + count;
+    }
+  }
+  return true;
+}
+
+} // namespace nopticon
@@ -0,0 +1,21 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include "analysis.hh"
+
+namespace nopticon {
+
+/// Elementary cycles in the forwarding graph of the flow, each starting
+/// at its smallest node, up to the given maximum (Johnson's algorithm)
+loops_t find_cycles(const_flow_t, std::size_t max_cycles);
+
+/// Number of forwarding paths from a source to each node it reaches
+typedef std::unordered_map<nid_t, uint64_t> path_counts_t;
+
+/// Counts saturate at UINT64_MAX; returns false, and leaves the counts
+/// incomplete, if a forwarding loop is reachable from the source
+bool count_paths(const_flow_t, source_t, path_counts_t &);
+
+} // namespace nopticon
@@ -0,0 +1,169 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "flow_check.hh"
+
+#include <algorithm>
+
+namespace nopticon {
+
+constexpr uint32_t flow_check_t::NONE;
+
+flow_check_t::flow_check_t(std::size_t number_of_nodes)
+    : m_words{(number_of_nodes + 63) / 64}, m_index(number_of_nodes, NONE) {}
+
+void flow_check_t::check(const_flow_t flow) {
+  for (auto n : m_nodes) {
+    m_index[n] = NONE;
+  }
+  m_nodes.clear();
+  m_targets.clear();
+  m_members.clear();
+  m_component_begin.clear();
+  m_reach.clear();
+  m_loops.clear();
+  m_blackholes.clear();
+
+  for (auto &kv : flow->data) {
+    assert(kv.first < m_index.size());
+    m_index[kv.first] = m_nodes.size();
+    m_nodes.push_back(kv.first);
+    m_targets.push_back(&kv.second->target);
+  }
+  auto size = m_nodes.size();
+  m_component.assign(size, NONE);
+  m_order.assign(size, NONE);
+  m_low.resize(size);
+  m_parent.assign(size, NONE);
+  m_is_on_stack.assign(size, false);
+
+  // iterative depth-first search where each frame is a node and the
+  // position of its next target
+  uint32_t counter = 0;
+  auto visit = [&](uint32_t v) {
+    m_order[v] = m_low[v] = counter++;
+    m_stack.push_back(v);
+    m_is_on_stack[v] = true;
+    m_frames.emplace_back(v, 0);
+  };
+  for (uint32_t root = 0; root < size; ++root) {
+    if (m_order[root] != NONE) {
+      continue;
+    }
+    visit(root);
+    while (not m_frames.empty()) {
+      auto v = m_frames.back().first;
+      auto &i = m_frames.back().second;
+      auto &target = *m_targets[v];
+      if (i < target.size()) {
+        auto t = target[i++];
+        assert(t < m_index.size());
+        auto w = m_index[t];
+        if (w == NONE) {
+          m_blackholes.push_back(t);
+        } else if (m_order[w] == NONE) {
+          visit(w);
+        } else if (m_is_on_stack[w]) {
+          m_low[v] = std::min(m_low[v], m_order[w]);
+        }
+        continue;
+      }
+      m_frames.pop_back();
+      if (not m_frames.empty()) {
+        auto u = m_frames.back().first;
+        m_low[u] = std::min(m_low[u], m_low[v]);
+      }
+      if (m_low[v] == m_order[v]) {
+        close_component(v);
+      }
+    }
+    assert(m_stack.empty());
+  }
+
+  std::sort(m_blackholes.begin(), m_blackholes.end());
+  m_blackholes.erase(std::unique(m_blackholes.begin(), m_blackholes.end()),
+                     m_blackholes.end());
+  std::sort(m_loops.begin(), m_loops.end());
+}
+
+void flow_check_t::close_component(uint32_t v) {
+  uint32_t component = m_component_begin.size();
+  auto begin = m_members.size();
+  m_component_begin.push_back(begin);
+  uint32_t w;
+  do {
+    w = m_stack.back();
+    m_stack.pop_back();
+    m_is_on_stack[w] = false;
+    m_component[w] = component;
+    m_members.push_back(w);
+  } while (w != v);
+
+  // components are closed after all components they forward to
+  m_reach.resize(m_reach.size() + m_words);
+  auto reach = &m_reach[component * m_words];
+  bool is_cyclic = m_members.size() - begin > 1;
+  for (auto i = begin; i < m_members.size(); ++i) {
+    auto u = m_members[i];
+    for (auto t : *m_targets[u]) {
+      reach[t / 64] |= uint64_t{1} << (t % 64);
+      auto x = m_index[t];
+      if (x == NONE) {
+        continue;
+      }
+      if (m_component[x] == component) {
+        is_cyclic |= x == u;
+        continue;
+      }
+      auto other_reach = &m_reach[m_component[x] * m_words];
+      for (std::size_t j = 0; j < m_words; ++j) {
+        reach[j] |= other_reach[j];
+      }
+    }
+  }
+  if (is_cyclic) {
+    m_loops.push_back(find_loop(component));
+  }
+}
+
+loop_t flow_check_t::find_loop(uint32_t component) {
+  auto begin = m_members.begin() + m_component_begin[component];
+  auto s = *std::min_element(begin, m_members.end(), [&](uint32_t x, uint32_t y) {
+    return m_nodes[x] < m_nodes[y];
+  });
+
+  // breadth-first search inside the component until it returns to s
+  assert(m_queue.empty());
+  loop_t loop;
+  m_queue.push_back(s);
+  m_parent[s] = s;
+  for (std::size_t i = 0; i < m_queue.size() and loop.empty(); ++i) {
+    auto v = m_queue[i];
+    for (auto t : *m_targets[v]) {
+      auto w = m_index[t];
+      if (w == NONE or m_component[w] != component) {
+        continue;
+      }
+      if (w == s) {
+        for (; v != s; v = m_parent[v]) {
+          loop.push_back(m_nodes[v]);
+        }
+        loop.push_back(m_nodes[s]);
+        std::reverse(loop.begin(), loop.end());
+        break;
+      }
+      if (m_parent[w] == NONE) {
+        m_parent[w] = v;
+        m_queue.push_back(w);
+      }
+    }
+  }
+  assert(not loop.empty());
+  for (auto v : m_queue) {
+    m_parent[v] = NONE;
+  }
+  m_queue.clear();
+  return loop;
+}
+
+} // namespace nopticon
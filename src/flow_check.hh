@@ -0,0 +1,92 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include "flow_graph.hh"
+
+namespace nopticon {
+
+typedef std::vector<nid_t> loop_t;
+typedef std::vector<loop_t> loops_t;
+
+/// Forwarding loops, blackholes and reachability of a flow, all found
+/// in a single traversal of its forwarding graph (Tarjan's algorithm)
+class flow_check_t {
+public:
+  flow_check_t(std::size_t number_of_nodes);
+
+  /// Results are valid until the next check
+  void check(const_flow_t);
+
+  /// Shortest loop through the smallest node of each strongly connected
+  /// component that contains a cycle, in increasing order
+  const loops_t &loops() const noexcept { return m_loops; }
+
+  /// Next hops that have no rule for the flow, in increasing order
+  const std::vector<nid_t> &blackholes() const noexcept {
+    return m_blackholes;
+  }
+
+  /// Nodes that have a rule for the flow, in no particular order
+  const std::vector<nid_t> &sources() const noexcept { return m_nodes; }
+
+  /// Whether t is reachable from s in one or more hops
+  bool is_reachable(nid_t s, nid_t t) const noexcept {
+    assert(s < m_index.size() and t < m_index.size());
+    auto v = m_index[s];
+    if (v == NONE) {
+      return false;
+    }
+    auto reach = &m_reach[m_component[v] * m_words];
+    return reach[t / 64] & (uint64_t{1} << (t % 64));
+  }
+
+  /// Calls f(t) for each t that is reachable from s, in increasing order
+  template <class F> void for_each_reachable(nid_t s, F f) const {
+    assert(s < m_index.size());
+    auto v = m_index[s];
+    if (v == NONE) {
+      return;
+    }
+    auto reach = &m_reach[m_component[v] * m_words];
+    for (std::size_t i = 0; i < m_words; ++i) {
+      for (auto word = reach[i]; word != 0; word &= word - 1) {
+        f(static_cast<nid_t>(i * 64 + __builtin_ctzll(word)));
+      }
+    }
+  }
+
+private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  const std::size_t m_words;
+
+  // nodes with a rule and their next hops; m_index maps from a node
+  // to its position in m_nodes, or NONE if it has no rule
+  std::vector<nid_t> m_nodes;
+  std::vector<const next_hops_t *> m_targets;
+  std::vector<uint32_t> m_index;
+
+  // strongly connected component of each node, its members ordered by
+  // component, where each component's reach is a bitset of m_words
+  std::vector<uint32_t> m_component;
+  std::vector<uint32_t> m_members;
+  std::vector<uint32_t> m_component_begin;
+  std::vector<uint64_t> m_reach;
+
+  loops_t m_loops;
+  std::vector<nid_t> m_blackholes;
+
+  // scratch space for Tarjan's algorithm and the loop search
+  std::vector<uint32_t> m_order, m_low, m_stack, m_parent, m_queue;
+  std::vector<bool> m_is_on_stack;
+  std::vector<std::pair<uint32_t, std::size_t>> m_frames;
+
+  /// Pops the strongly connected component whose root is the given node
+  void close_component(uint32_t);
+
+  loop_t find_loop(uint32_t component);
+};
+
+} // namespace nopticon
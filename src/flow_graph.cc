@@ -3,19 +3,178 @@
 
 #include "flow_graph.hh"
 
+#include <algorithm>
+#include <tuple>
+
 namespace nopticon {
 
-inline bool rule_order_t::operator()(const rule_t &x, const rule_t &y) const
-    noexcept {
-  if (x.source == y.source) {
-    return ip_prefix_order(x.ip_prefix, y.ip_prefix);
+rule_ref_t flow_graph_t::find(const ip_prefix_t &ip_prefix,
+                              source_t source) const {
+  auto &source_rules = rules(source);
+  auto iter = source_rules.find(make_key(ip_prefix));
+  if (iter == source_rules.end()) {
+    return nullptr;
   }
-  return x.source < y.source;
+  return &iter->second;
 }
 
-rule_ref_t flow_graph_t::find(const ip_prefix_t &ip_prefix,
-                              source_t source) const {
-  return m_rule_set.find(rule_t(ip_prefix, source));
+const rules_t &flow_graph_t::rules(source_t source) const {
+  static const rules_t s_empty_rules;
+  if (source >= m_rules_per_source.size()) {
+    return s_empty_rules;
+  }
+  return m_rules_per_source[source];
+}
+
+const flow_counts_t &flow_graph_t::node_flows(nid_t nid) const {
+  static const flow_counts_t s_empty_flow_counts;
+  if (nid >= m_node_flows.size()) {
+    return s_empty_flow_counts;
+  }
+  return m_node_flows[nid];
+}
+
+const const_flows_t &flow_graph_t::link_flows(nid_t source,
+                                              nid_t target) const {
+  static const const_flows_t s_empty_flows;
+  auto iter = m_link_flows.find(make_link(source, target));
+  if (iter == m_link_flows.end()) {
+    return s_empty_flows;
+  }
+  return iter->second;
+}
+
+void flow_graph_t::increment(nid_t nid, const_flow_t flow) {
+  if (nid >= m_node_flows.size()) {
+    m_node_flows.resize(nid + 1);
+  }
+  ++m_node_flows[nid][flow];
+}
+
+void flow_graph_t::decrement(nid_t nid, const_flow_t flow) {
+  assert(nid < m_node_flows.size());
+  auto &flow_counts = m_node_flows[nid];
+  auto iter = flow_counts.find(flow);
+  assert(iter != flow_counts.end());
+  if (--iter->second == 0) {
+    flow_counts.erase(iter);
+  }
+}
+
+static inline uint64_t mix(uint64_t x) noexcept {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t make_hash(source_t source,
+                          const next_hops_t &target) noexcept {
+  auto hash = mix(source);
+  for (auto t : target) {
+    hash = mix(hash ^ t);
+  }
+  return hash;
+}
+
+/// Flows without forwarding are not accounted for in subtree hashes
+static uint64_t make_hash(const ip_prefix_t &ip_prefix,
+                          uint64_t forwarding_hash) noexcept {
+  if (forwarding_hash == 0) {
+    return 0;
+  }
+  return mix(mix(static_cast<uint64_t>(ip_prefix.mask) << 32 |
+                 ip_prefix.ip_addr) ^
+             forwarding_hash);
+}
+
+flow_graph_t::flow_hash_t &flow_graph_t::flow_hash(const_flow_t flow) const {
+  if (flow->id >= m_flow_hashes.size()) {
+    m_flow_hashes.resize((flow->id + 1) << 1);
+  }
+  return m_flow_hashes[flow->id];
+}
+
+uint64_t flow_graph_t::forwarding_hash(const_flow_t flow) const {
+  return flow_hash(flow).forwarding;
+}
+
+uint64_t flow_graph_t::subtree_hash(const_flow_t flow) const {
+  sync_hashes();
+  return flow_hash(flow).subtree;
+}
+
+void flow_graph_t::sync_hashes() const {
+  for (auto flow : m_unsynced_flows) {
+    auto &hash = flow_hash(flow);
+    assert(not hash.is_synced);
+    hash.is_synced = true;
+    auto delta = make_hash(flow->ip_prefix, hash.synced) ^
+                 make_hash(flow->ip_prefix, hash.forwarding);
+    hash.synced = hash.forwarding;
+    for (auto ancestor = flow; ancestor != nullptr;
+         ancestor = ancestor->parent()) {
+      flow_hash(ancestor).subtree ^= delta;
+    }
+  }
+  m_unsynced_flows.clear();
+}
+
+void flow_graph_t::update_forwarding_hash(const_flow_t flow, uint64_t delta) {
+  auto &hash = flow_hash(flow);
+  if (hash.forwarding != 0) {
+    auto iter = m_equivalence_classes.find(hash.forwarding);
+    assert(iter != m_equivalence_classes.end());
+    iter->second.erase(flow);
+    if (iter->second.empty()) {
+      m_equivalence_classes.erase(iter);
+    }
+  }
+  hash.forwarding ^= delta;
+  if (hash.forwarding != 0) {
+    m_equivalence_classes[hash.forwarding].insert(flow);
+  }
+  if (hash.is_synced) {
+    hash.is_synced = false;
+    m_unsynced_flows.push_back(flow);
+  }
+}
+
+const const_flows_t &
+flow_graph_t::equivalence_class(const_flow_t flow) const {
+  static const const_flows_t s_empty_flows;
+  auto iter = m_equivalence_classes.find(forwarding_hash(flow));
+  if (iter == m_equivalence_classes.end()) {
+    return s_empty_flows;
+  }
+  return iter->second;
+}
+
+void flow_graph_t::index_rule(source_t source, const next_hops_t &target,
+                              const_flow_t flow) {
+  update_forwarding_hash(flow, make_hash(source, target));
+  increment(source, flow);
+  for (auto t : target) {
+    increment(t, flow);
+    m_link_flows[make_link(source, t)].insert(flow);
+  }
+}
+
+void flow_graph_t::unindex_rule(source_t source, const next_hops_t &target,
+                                const_flow_t flow) {
+  update_forwarding_hash(flow, make_hash(source, target));
+  decrement(source, flow);
+  for (auto t : target) {
+    decrement(t, flow);
+    auto iter = m_link_flows.find(make_link(source, t));
+    if (iter == m_link_flows.end()) {
+      continue;
+    }
+    iter->second.erase(flow);
+    if (iter->second.empty()) {
+      m_link_flows.erase(iter);
+    }
+  }
 }
 
 void flow_graph_t::insert_flow(rule_ref_t rule_ref, flow_t flow) {
@@ -23,6 +182,7 @@ void flow_graph_t::insert_flow(rule_ref_t rule_ref, flow_t flow) {
   assert(ok(emplace_result));
   auto insert_result = rule_ref->flows.insert(flow);
   assert(ok(insert_result));
+  index_rule(rule_ref->source, rule_ref->target, flow);
 }
 
 void flow_graph_t::reassign_flow(rule_ref_t current_owner, rule_ref_t rule_ref,
@@ -34,6 +194,8 @@ void flow_graph_t::reassign_flow(rule_ref_t current_owner, rule_ref_t rule_ref,
   flow->data.at(rule_ref->source) = rule_ref;
   auto insert_result = rule_ref->flows.insert(flow);
   assert(ok(insert_result));
+  unindex_rule(current_owner->source, current_owner->target, flow);
+  index_rule(rule_ref->source, rule_ref->target, flow);
 }
 
 static void insert_flows(affected_flows_t &affected_flows,
@@ -43,39 +205,62 @@ static void insert_flows(affected_flows_t &affected_flows,
   }
 }
 
+flow_t flow_graph_t::make_flow(const ip_prefix_t &ip_prefix) {
+  flow_t parent;
+  auto &flow_tree = m_flow_tree.insert(ip_prefix, m_next_flow_id, parent);
+  if (flow_tree.id == m_next_flow_id) {
+    m_next_flow_id++;
+    // the new flow may have taken over some of its parent's children
+    auto &hash = flow_hash(&flow_tree);
+    for (auto &child : flow_tree.children()) {
+      hash.subtree ^= flow_hash(child.second).subtree;
+    }
+    flow_tree.data = parent->data;
+    for (auto &pair : flow_tree.data) {
+      pair.second->flows.insert(&flow_tree);
+      index_rule(pair.first, pair.second->target, &flow_tree);
+    }
+  }
+  return &flow_tree;
+}
+
 bool flow_graph_t::insert_or_assign(const ip_prefix_t &ip_prefix,
                                     source_t source, const target_t &new_target,
                                     affected_flows_t &affected_flows) {
   rule_ref_t rule_ref;
   {
-    rule_t new_rule{ip_prefix, source};
-    rule_ref = m_rule_set.lower_bound(new_rule);
-    if (rule_ref != m_rule_set.end() and
-        not m_rule_set.key_comp()(new_rule, *rule_ref)) {
+    if (source >= m_rules_per_source.size()) {
+      m_rules_per_source.resize(source + 1);
+    }
+    auto &source_rules = m_rules_per_source[source];
+    auto result = source_rules.emplace(std::piecewise_construct,
+                                       std::forward_as_tuple(make_key(ip_prefix)),
+                                       std::forward_as_tuple(ip_prefix, source));
+    rule_ref = &result.first->second;
+    if (not result.second) {
       assert(ip_prefix == rule_ref->ip_prefix);
       assert(source == rule_ref->source);
-      if (new_target != rule_ref->target) {
-        rule_ref->target = new_target;
-        insert_flows(affected_flows, rule_ref->flows);
+      auto next_hops = m_next_hops_table.intern(new_target);
+      if (next_hops == rule_ref->target) {
+        m_next_hops_table.release(next_hops);
+        return false;
+      }
+      for (auto flow : rule_ref->flows) {
+        unindex_rule(source, rule_ref->target, flow);
+        index_rule(source, next_hops, flow);
       }
+      m_next_hops_table.release(rule_ref->target);
+      rule_ref->target = next_hops;
+      insert_flows(affected_flows, rule_ref->flows);
       return false;
     }
 
-    rule_ref = m_rule_set.insert(rule_ref, std::move(new_rule));
-    rule_ref->target = new_target;
+    ++m_number_of_rules;
+    rule_ref->target = m_next_hops_table.intern(new_target);
     assert(ip_prefix == rule_ref->ip_prefix);
     assert(source == rule_ref->source);
   }
-  flow_t parent;
-  auto &flow_tree = m_flow_tree.insert(ip_prefix, m_next_flow_id, parent);
-  if (flow_tree.id == m_next_flow_id) {
-    m_next_flow_id++;
-    flow_tree.data = parent->data;
-    for (auto &pair : flow_tree.data) {
-      pair.second->flows.insert(&flow_tree);
-    }
-  }
-  auto flow_tree_iter = flow_tree.iter();
+  auto flow_tree_iter = make_flow(ip_prefix)->iter();
   do {
     auto flow = flow_tree_iter.ptr();
     assert(flow != nullptr);
@@ -95,17 +280,122 @@ bool flow_graph_t::insert_or_assign(const ip_prefix_t &ip_prefix,
   return true;
 }
 
+void sort_routes(routes_t &routes) {
+  ip_prefix_order_t ip_prefix_order;
+  std::stable_sort(routes.begin(), routes.end(),
+                   [&](const route_t &x, const route_t &y) {
+                     return ip_prefix_order(x.first, y.first);
+                   });
+  auto last = routes.begin();
+  for (auto iter = routes.begin(); iter != routes.end(); ++iter) {
+    auto next = std::next(iter);
+    if (next != routes.end() and next->first == iter->first) {
+      continue;
+    }
+    if (last != iter) {
+      *last = std::move(*iter);
+    }
+    ++last;
+  }
+  routes.erase(last, routes.end());
+}
+
+std::size_t flow_graph_t::insert_or_assign(source_t source,
+                                           const routes_t &routes,
+                                           affected_flows_t &affected_flows) {
+  assert(std::adjacent_find(routes.begin(), routes.end(),
+                            [](const route_t &x, const route_t &y) {
+                              return not ip_prefix_order_t()(x.first,
+                                                             y.first);
+                            }) == routes.end());
+  if (source >= m_rules_per_source.size()) {
+    m_rules_per_source.resize(source + 1);
+  }
+  auto &source_rules = m_rules_per_source[source];
+  // flow of each new rule, and existing rules with new next hops
+  std::vector<std::pair<flow_t, rule_ref_t>> new_rules;
+  std::vector<rule_ref_t> assigned_rules;
+  for (auto &route : routes) {
+    auto &ip_prefix = route.first;
+    auto result = source_rules.emplace(
+        std::piecewise_construct, std::forward_as_tuple(make_key(ip_prefix)),
+        std::forward_as_tuple(ip_prefix, source));
+    rule_ref_t rule_ref = &result.first->second;
+    auto next_hops = m_next_hops_table.intern(route.second);
+    if (result.second) {
+      rule_ref->target = next_hops;
+      new_rules.emplace_back(make_flow(ip_prefix), rule_ref);
+      continue;
+    }
+    if (next_hops == rule_ref->target) {
+      m_next_hops_table.release(next_hops);
+      continue;
+    }
+    for (auto flow : rule_ref->flows) {
+      unindex_rule(source, rule_ref->target, flow);
+      index_rule(source, next_hops, flow);
+    }
+    m_next_hops_table.release(rule_ref->target);
+    rule_ref->target = next_hops;
+    assigned_rules.push_back(rule_ref);
+  }
+  m_number_of_rules += new_rules.size();
+
+  // Every flow in the subtree of a new rule is owned by the rule of the
+  // source with the longest matching IP prefix, which is the rule of the
+  // flow's own IP prefix, if any, or otherwise the owner of its parent.
+  // Since the routes are sorted, nested new rules are in the subtree of
+  // their outermost new rule, so each flow is visited at most once.
+  const ip_prefix_t *outermost = nullptr;
+  for (auto &new_rule : new_rules) {
+    auto &ip_prefix = new_rule.second->ip_prefix;
+    if (outermost != nullptr and subset(ip_prefix, *outermost)) {
+      continue;
+    }
+    outermost = &ip_prefix;
+    auto flow_tree_iter = new_rule.first->iter();
+    do {
+      auto flow = flow_tree_iter.ptr();
+      assert(flow != nullptr);
+      rule_ref_t owner;
+      auto rule_iter = source_rules.find(make_key(flow->ip_prefix));
+      if (rule_iter != source_rules.end()) {
+        owner = &rule_iter->second;
+      } else {
+        owner = flow->parent()->data.at(source);
+      }
+      auto data_iter = flow->data.find(source);
+      if (data_iter == flow->data.end()) {
+        insert_flow(owner, flow);
+        affected_flows.push_back(flow);
+      } else if (data_iter->second != owner) {
+        reassign_flow(data_iter->second, owner, flow);
+        affected_flows.push_back(flow);
+      }
+    } while (flow_tree_iter.next());
+  }
+
+  // new rules only take over flows from rules with shorter IP prefixes,
+  // so these flows have not been affected yet
+  for (auto rule_ref : assigned_rules) {
+    insert_flows(affected_flows, rule_ref->flows);
+  }
+  return new_rules.size();
+}
+
 bool flow_graph_t::erase(const ip_prefix_t &ip_prefix, source_t source,
                          affected_flows_t &affected_flows) {
   flow_t parent_flow = nullptr;
   rule_ref_t rule_ref, parent_rule_ref;
-  {
-    rule_t erase_rule{ip_prefix, source};
-    rule_ref = m_rule_set.find(erase_rule);
-    if (rule_ref == m_rule_set.end()) {
-      return false;
-    }
+  if (source >= m_rules_per_source.size()) {
+    return false;
   }
+  auto &source_rules = m_rules_per_source[source];
+  auto rule_iter = source_rules.find(make_key(ip_prefix));
+  if (rule_iter == source_rules.end()) {
+    return false;
+  }
+  rule_ref = &rule_iter->second;
   assert(ip_prefix == rule_ref->ip_prefix);
   assert(source == rule_ref->source);
   {
@@ -132,6 +422,7 @@ bool flow_graph_t::erase(const ip_prefix_t &ip_prefix, source_t source,
   if (parent_flow == nullptr) {
     for (auto flow : rule_ref->flows) {
       flow->data.erase(source);
+      unindex_rule(source, rule_ref->target, flow);
     }
   } else {
     assert(subset(parent_flow->ip_prefix, parent_rule_ref->ip_prefix));
@@ -147,11 +438,134 @@ bool flow_graph_t::erase(const ip_prefix_t &ip_prefix, source_t source,
       data_iter->second = parent_rule_ref;
       auto flow_result = parent_rule_ref->flows.insert(flow);
       assert(ok(flow_result));
+      unindex_rule(source, rule_ref->target, flow);
+      index_rule(source, parent_rule_ref->target, flow);
     }
   }
   insert_flows(affected_flows, rule_ref->flows);
-  m_rule_set.erase(rule_ref);
+  m_next_hops_table.release(rule_ref->target);
+  source_rules.erase(rule_iter);
+  --m_number_of_rules;
   return true;
 }
 
+std::size_t flow_graph_t::erase_source(source_t source,
+                                       affected_flows_t &affected_flows) {
+  if (source >= m_rules_per_source.size()) {
+    return 0;
+  }
+  // no rule of the source is left to take over the flows
+  auto &source_rules = m_rules_per_source[source];
+  for (auto &pair : source_rules) {
+    auto &rule = pair.second;
+    assert(rule.source == source);
+    for (auto flow : rule.flows) {
+      assert(flow->data.at(source) == &rule);
+      flow->data.erase(source);
+      unindex_rule(source, rule.target, flow);
+    }
+    insert_flows(affected_flows, rule.flows);
+    m_next_hops_table.release(rule.target);
+  }
+  auto number_of_rules = source_rules.size();
+  assert(number_of_rules <= m_number_of_rules);
+  m_number_of_rules -= number_of_rules;
+  source_rules.clear();
+  return number_of_rules;
+}
+
+static std::vector<source_t> diff(const rule_ref_per_source_t &a,
+                                  const rule_ref_per_source_t &b) {
+  std::vector<source_t> sources;
+  for (auto &pair : a) {
+    auto iter = b.find(pair.first);
+    if (iter == b.end() or iter->second->target != pair.second->target) {
+      sources.push_back(pair.first);
+    }
+  }
+  for (auto &pair : b) {
+    if (a.count(pair.first) == 0) {
+      sources.push_back(pair.first);
+    }
+  }
+  std::sort(sources.begin(), sources.end());
+  return sources;
+}
+
+typedef std::vector<std::pair<ip_prefix_t, const_flow_t>> children_t;
+
+/// Children of the flow within the IP prefix, in IP prefix order
+static children_t make_children(const_flow_t flow,
+                                const ip_prefix_t &ip_prefix) {
+  auto &children = flow->children();
+  auto iter = flow->ip_prefix == ip_prefix ? children.begin()
+                                           : children.lower_bound(ip_prefix);
+  children_t result;
+  for (; iter != children.end() and subset(iter->first, ip_prefix); ++iter) {
+    result.emplace_back(iter->first, iter->second);
+  }
+  return result;
+}
+
+/// Flows a and b are the most specific ones that contain the IP prefix
+static void diff(const flow_graph_t &x, const flow_graph_t &y, const_flow_t a,
+                 const_flow_t b, const ip_prefix_t &ip_prefix,
+                 flow_diffs_t &flow_diffs) {
+  if (a->ip_prefix == ip_prefix and b->ip_prefix == ip_prefix and
+      x.subtree_hash(a) == y.subtree_hash(b)) {
+    return;
+  }
+  auto sources = diff(a->data, b->data);
+  if (not sources.empty()) {
+    flow_diffs.push_back({ip_prefix, a, b, std::move(sources)});
+  }
+  // siblings are disjoint, so merge both lists by maximal IP prefixes
+  auto a_children = make_children(a, ip_prefix);
+  auto b_children = make_children(b, ip_prefix);
+  ip_prefix_order_t ip_prefix_order;
+  auto a_iter = a_children.begin(), b_iter = b_children.begin();
+  while (a_iter != a_children.end() or b_iter != b_children.end()) {
+    if (b_iter == b_children.end()) {
+      diff(x, y, a_iter->second, b, a_iter->first, flow_diffs);
+      ++a_iter;
+    } else if (a_iter == a_children.end()) {
+      diff(x, y, a, b_iter->second, b_iter->first, flow_diffs);
+      ++b_iter;
+    } else if (a_iter->first == b_iter->first) {
+      diff(x, y, a_iter->second, b_iter->second, a_iter->first, flow_diffs);
+      ++a_iter;
+      ++b_iter;
+    } else if (subset(a_iter->first, b_iter->first)) {
+      diff(x, y, a, b_iter->second, b_iter->first, flow_diffs);
+      while (a_iter != a_children.end() and
+             subset(a_iter->first, b_iter->first)) {
+        ++a_iter;
+      }
+      ++b_iter;
+    } else if (subset(b_iter->first, a_iter->first)) {
+      diff(x, y, a_iter->second, b, a_iter->first, flow_diffs);
+      while (b_iter != b_children.end() and
+             subset(b_iter->first, a_iter->first)) {
+        ++b_iter;
+      }
+      ++a_iter;
+    } else if (ip_prefix_order(a_iter->first, b_iter->first)) {
+      diff(x, y, a_iter->second, b, a_iter->first, flow_diffs);
+      ++a_iter;
+    } else {
+      diff(x, y, a, b_iter->second, b_iter->first, flow_diffs);
+      ++b_iter;
+    }
+  }
+}
+
+flow_diffs_t diff(const flow_graph_t &x, const flow_graph_t &y) {
+  flow_diffs_t flow_diffs;
+  auto &a = x.flow_tree();
+  auto &b = y.flow_tree();
+  assert(a.ip_prefix == b.ip_prefix);
+  diff(x, y, &a, &b, a.ip_prefix, flow_diffs);
+  return flow_diffs;
+}
+
 } // namespace nopticon
@@ -4,24 +4,18 @@
 #pragma once
 
 #include "ip_prefix_tree.hh"
+#include "next_hops.hh"
 
-#include <set>
 #include <unordered_map>
 #include <unordered_set>
 
 namespace nopticon {
 
-typedef uint32_t nid_t;
 typedef nid_t source_t;
-typedef std::vector<nid_t> target_t;
 
 struct rule_t;
-struct rule_order_t {
-  ip_prefix_order_t ip_prefix_order;
-  bool operator()(const rule_t &, const rule_t &) const noexcept;
-};
-typedef std::set<rule_t, rule_order_t> rule_set_t;
-typedef rule_set_t::iterator rule_ref_t;
+/// Stable until the rule is erased
+typedef const rule_t *rule_ref_t;
 typedef std::unordered_map<source_t, rule_ref_t> rule_ref_per_source_t;
 typedef ip_prefix_tree_t<rule_ref_per_source_t> flow_tree_t;
 typedef typename flow_tree_t::ptr_t flow_t;
@@ -33,37 +27,150 @@ struct rule_t {
   ip_prefix_t ip_prefix;
   source_t source;
 
-  mutable target_t target;
+  mutable next_hops_t target;
   mutable flows_t flows;
 
   rule_t(const ip_prefix_t &ip_prefix, source_t source)
       : ip_prefix{ip_prefix}, source{source}, target{}, flows{} {}
 };
 
+/// Rules of a source, keyed by their packed IP prefix
+typedef std::unordered_map<uint64_t, rule_t> rules_t;
+
 typedef std::vector<const_flow_t> affected_flows_t;
 
+typedef std::pair<ip_prefix_t, target_t> route_t;
+typedef std::vector<route_t> routes_t;
+
+/// Strictly sorts the routes in IP prefix order; of several routes for
+/// the same IP prefix, the last one is kept, as if they were inserted in
+/// sequence
+void sort_routes(routes_t &);
+
 typedef flow_tree_t::id_t flow_id_t;
 
+/// Number of times a node occurs in the forwarding rules of each flow
+typedef std::unordered_map<const_flow_t, uint32_t> flow_counts_t;
+
 class flow_graph_t {
 public:
   /// Returns true when a new rule has been created; false otherwise
   bool insert_or_assign(const ip_prefix_t &, source_t, const target_t &,
                         affected_flows_t &);
 
+  /// Inserts or assigns the rules of a source from routes that are
+  /// strictly sorted in IP prefix order, such as its initial RIB, in one
+  /// pass over the flow tree; returns the number of new rules
+  std::size_t insert_or_assign(source_t, const routes_t &,
+                               affected_flows_t &);
+
   /// Returns true if the rule existed; false otherwise
   bool erase(const ip_prefix_t &, source_t, affected_flows_t &);
 
+  /// Erases every rule of the source in one sweep, and returns how many
+  /// rules there were
+  std::size_t erase_source(source_t, affected_flows_t &);
+
+  /// Returns nullptr if there is no such rule
   rule_ref_t find(const ip_prefix_t &, source_t) const;
-  const rule_set_t &rule_set() const { return m_rule_set; }
+
+  /// Rules of the source, in no particular order
+  const rules_t &rules(source_t) const;
+
+  /// Indexed by source
+  const std::vector<rules_t> &rules_per_source() const {
+    return m_rules_per_source;
+  }
+
+  std::size_t number_of_rules() const noexcept { return m_number_of_rules; }
+
+  const next_hops_table_t &next_hops_table() const { return m_next_hops_table; }
   const flow_tree_t &flow_tree() const { return m_flow_tree; }
 
+  /// Flows in which the node forwards or is a next hop
+  const flow_counts_t &node_flows(nid_t) const;
+
+  /// Flows in which the source forwards to the target
+  const const_flows_t &link_flows(nid_t source, nid_t target) const;
+
+  /// Hash of the next hops of each source in the flow
+  uint64_t forwarding_hash(const_flow_t) const;
+
+  /// Hash of the IP prefix and forwarding hash of each flow in the
+  /// subtree whose forwarding is non-empty
+  uint64_t subtree_hash(const_flow_t) const;
+
+  /// Flows whose sources forward exactly alike, identified by their
+  /// forwarding hash; empty if the flow has no forwarding
+  const const_flows_t &equivalence_class(const_flow_t) const;
+
+  std::size_t number_of_equivalence_classes() const noexcept {
+    return m_equivalence_classes.size();
+  }
+
 private:
+  /// Flow of the IP prefix, which is created if need be
+  flow_t make_flow(const ip_prefix_t &);
   void insert_flow(rule_ref_t, flow_t);
   void reassign_flow(rule_ref_t, rule_ref_t, flow_t);
 
-  rule_set_t m_rule_set;
+  // maintain the inverted indexes whenever a flow's data changes
+  void index_rule(source_t, const next_hops_t &, const_flow_t);
+  void unindex_rule(source_t, const next_hops_t &, const_flow_t);
+  void increment(nid_t, const_flow_t);
+  void decrement(nid_t, const_flow_t);
+
+  static uint64_t make_key(const ip_prefix_t &ip_prefix) {
+    return static_cast<uint64_t>(ip_prefix.ip_addr) << 32 | ip_prefix.mask;
+  }
+
+  static uint64_t make_link(nid_t source, nid_t target) {
+    return static_cast<uint64_t>(source) << 32 | target;
+  }
+
+  struct flow_hash_t {
+    uint64_t forwarding = 0;
+    // forwarding hash that is accounted for in the subtree hashes
+    uint64_t synced = 0;
+    uint64_t subtree = 0;
+    bool is_synced = true;
+  };
+
+  flow_hash_t &flow_hash(const_flow_t) const;
+
+  /// Moves the flow to the equivalence class of its new forwarding hash
+  void update_forwarding_hash(const_flow_t, uint64_t delta);
+
+  /// Propagate changed forwarding hashes to the subtree hashes
+  void sync_hashes() const;
+
+  std::vector<rules_t> m_rules_per_source;
+  std::size_t m_number_of_rules = 0;
+  next_hops_table_t m_next_hops_table;
   flow_tree_t m_flow_tree;
   flow_id_t m_next_flow_id = 1;
+  std::vector<flow_counts_t> m_node_flows;
+  std::unordered_map<uint64_t, const_flows_t> m_link_flows;
+
+  // indexed by flow id, and updated lazily
+  mutable std::vector<flow_hash_t> m_flow_hashes;
+  mutable std::vector<const_flow_t> m_unsynced_flows;
+  std::unordered_map<uint64_t, const_flows_t> m_equivalence_classes;
 };
 
+/// Region of IP addresses whose forwarding differs between two flow graphs
+struct flow_diff_t {
+  ip_prefix_t ip_prefix;
+  /// Most specific flow in each flow graph that contains the IP prefix
+  const_flow_t a, b;
+  /// Sources whose next hops differ, in increasing order
+  std::vector<source_t> sources;
+};
+
+typedef std::vector<flow_diff_t> flow_diffs_t;
+
+/// Regions in IP prefix order; walks both flow trees in merged order and
+/// skips subtrees with the same IP prefix and subtree hash
+flow_diffs_t diff(const flow_graph_t &, const flow_graph_t &);
+
 } // namespace nopticon
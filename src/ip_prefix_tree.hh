@@ -51,6 +51,10 @@ public:
   ip_prefix_tree_t(const ip_prefix_tree_t &) = delete;
 
   const ip_prefix_map_t<ptr_t> &children() const noexcept { return m_children; }
+
+  /// Null if and only if this is the root
+  const_ptr_t parent() const noexcept { return m_parent; }
+  ptr_t parent() noexcept { return m_parent; }
   const_ptr_t find(const ip_prefix_t &) const;
 
   ptr_t find(const ip_prefix_t &, std::vector<ptr_t> &);
@@ -66,6 +70,7 @@ private:
   friend class ip_prefix_tree_iter_t<T>;
   friend class ip_prefix_tree_const_iter_t<T>;
   ip_prefix_map_t<ptr_t> m_children;
+  ptr_t m_parent = nullptr;
   ip_addr_t m_cardinality = ip_prefix.mask;
 };
 
@@ -301,8 +306,10 @@ ip_prefix_tree_t<T> &ip_prefix_tree_t<T>::insert(const ip_prefix_t &ip_prefix,
         auto new_ip_prefix_tree_ptr =
             new ip_prefix_tree_t<T>(next_id, ip_prefix);
         auto &new_children = new_ip_prefix_tree_ptr->m_children;
+        new_ip_prefix_tree_ptr->m_parent = ip_prefix_tree_ptr;
         do {
           assert(child_iter->second->id != next_id);
+          child_iter->second->m_parent = new_ip_prefix_tree_ptr;
           new_children.emplace(child_iter->first, child_iter->second);
           auto child_cardinality = child_iter->second->m_cardinality;
           assert(new_ip_prefix_tree_ptr->m_cardinality >= child_cardinality);
@@ -340,6 +347,7 @@ ip_prefix_tree_t<T> &ip_prefix_tree_t<T>::insert(const ip_prefix_t &ip_prefix,
   auto emplace_result = ip_prefix_tree_ptr->m_children.emplace(
       ip_prefix, new ip_prefix_tree_t<T>(next_id, ip_prefix));
   assert(ok(emplace_result));
+  emplace_result.first->second->m_parent = ip_prefix_tree_ptr;
   parent = ip_prefix_tree_ptr;
   return *emplace_result.first->second;
 }
@@ -0,0 +1,183 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "mrt.hh"
+
+namespace nopticon {
+
+// MRT types and subtypes, and BGP path attribute types
+constexpr uint16_t TABLE_DUMP_V2 = 13;
+constexpr uint16_t PEER_INDEX_TABLE = 1;
+constexpr uint16_t RIB_IPV4_UNICAST = 2;
+constexpr uint16_t RIB_IPV4_UNICAST_ADDPATH = 8;
+constexpr uint8_t NEXT_HOP = 3;
+constexpr uint8_t MP_REACH_NLRI = 14;
+constexpr uint8_t EXTENDED_LENGTH = 0x10;
+
+/// Big-endian fields of a record; reading past its end sets is_ok to
+/// false and yields zeros
+struct mrt_cursor_t {
+  const uint8_t *pos, *end;
+  bool is_ok;
+
+  mrt_cursor_t(const uint8_t *begin, const uint8_t *end)
+      : pos{begin}, end{end}, is_ok{true} {}
+
+  const uint8_t *skip(std::size_t n) noexcept {
+    if (static_cast<std::size_t>(end - pos) < n) {
+      is_ok = false;
+      pos = end;
+      return nullptr;
+    }
+    auto begin = pos;
+    pos += n;
+    return begin;
+  }
+
+  uint32_t read(std::size_t n) noexcept {
+    auto bytes = skip(n);
+    uint32_t value = 0;
+    for (std::size_t i = 0; bytes != nullptr and i < n; ++i) {
+      value = value << 8 | bytes[i];
+    }
+    return value;
+  }
+
+  /// Cursor over the next n bytes, which are skipped
+  mrt_cursor_t slice(std::size_t n) noexcept {
+    auto begin = skip(n);
+    if (begin == nullptr) {
+      return {pos, pos};
+    }
+    return {begin, pos};
+  }
+
+  uint8_t u8() noexcept { return read(1); }
+  uint16_t u16() noexcept { return read(2); }
+  uint32_t u32() noexcept { return read(4); }
+};
+
+bool mrt_reader_t::fail(const char *error) {
+  m_error = error;
+  return false;
+}
+
+bool mrt_reader_t::read(mrt_routes_t &routes) {
+  routes.clear();
+  if (not m_error.empty()) {
+    return false;
+  }
+  for (;;) {
+    uint8_t header[12];
+    auto n = std::fread(header, 1, sizeof(header), m_file);
+    if (n == 0 and std::feof(m_file)) {
+      return false;
+    }
+    if (n != sizeof(header)) {
+      return fail("truncated MRT header");
+    }
+    mrt_cursor_t cursor{header, header + sizeof(header)};
+    m_timestamp = cursor.u32();
+    auto type = cursor.u16();
+    auto subtype = cursor.u16();
+    auto length = cursor.u32();
+    m_record.resize(length);
+    if (std::fread(m_record.data(), 1, length, m_file) != length) {
+      return fail("truncated MRT record");
+    }
+    if (type != TABLE_DUMP_V2) {
+      continue;
+    }
+    switch (subtype) {
+    case PEER_INDEX_TABLE:
+      if (not read_peer_index_table()) {
+        return false;
+      }
+      continue;
+    case RIB_IPV4_UNICAST:
+      return read_rib(false, routes);
+    case RIB_IPV4_UNICAST_ADDPATH:
+      return read_rib(true, routes);
+    }
+  }
+}
+
+bool mrt_reader_t::read_peer_index_table() {
+  mrt_cursor_t cursor{m_record.data(), m_record.data() + m_record.size()};
+  // collector BGP ID and view name
+  cursor.u32();
+  cursor.skip(cursor.u16());
+  m_peers.resize(cursor.u16());
+  for (auto &peer : m_peers) {
+    auto peer_type = cursor.u8();
+    peer.bgp_id = cursor.u32();
+    if (peer_type & 0x1) {
+      peer.ip_addr = 0;
+      cursor.skip(16);
+    } else {
+      peer.ip_addr = cursor.u32();
+    }
+    // AS number
+    cursor.skip(peer_type & 0x2 ? 4 : 2);
+  }
+  return cursor.is_ok or fail("malformed MRT peer index table");
+}
+
+bool mrt_reader_t::read_rib(bool is_add_path, mrt_routes_t &routes) {
+  mrt_cursor_t cursor{m_record.data(), m_record.data() + m_record.size()};
+  // sequence number
+  cursor.u32();
+  auto len = cursor.u8();
+  if (len > ip_prefix_t::MAX_LEN) {
+    return fail("malformed MRT IPv4 prefix");
+  }
+  auto bytes = (len + 7) / 8;
+  ip_prefix_t ip_prefix;
+  if (len != 0) {
+    ip_prefix = ip_prefix_t{cursor.read(bytes) << (32 - 8 * bytes), len};
+    ip_prefix.ip_addr &= ~ip_prefix.mask;
+  }
+  for (auto n = cursor.u16(); n != 0 and cursor.is_ok; --n) {
+    mrt_route_t route;
+    route.ip_prefix = ip_prefix;
+    route.peer_index = cursor.u16();
+    // originated time, and path identifier
+    cursor.skip(is_add_path ? 8 : 4);
+    auto attributes = cursor.slice(cursor.u16());
+    bool has_next_hop = false;
+    while (attributes.pos != attributes.end and attributes.is_ok) {
+      auto flags = attributes.u8();
+      auto type = attributes.u8();
+      auto length =
+          flags & EXTENDED_LENGTH ? attributes.u16() : attributes.u8();
+      auto value = attributes.slice(length);
+      if (type == NEXT_HOP and length == 4) {
+        route.next_hop = value.u32();
+        has_next_hop = true;
+      } else if (type == MP_REACH_NLRI and not has_next_hop) {
+        // abbreviated to the length and address of the next hop
+        if (value.u8() == 4) {
+          route.next_hop = value.u32();
+          has_next_hop = value.is_ok;
+        }
+      }
+    }
+    if (not attributes.is_ok) {
+      return fail("malformed MRT path attributes");
+    }
+    if (not cursor.is_ok) {
+      break;
+    }
+    if (route.peer_index >= m_peers.size()) {
+      return fail("MRT peer index out of range");
+    }
+    if (has_next_hop) {
+      routes.push_back(route);
+    } else {
+      ++m_number_of_skipped_routes;
+    }
+  }
+  return cursor.is_ok or fail("malformed MRT RIB record");
+}
+
+} // namespace nopticon
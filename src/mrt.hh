@@ -0,0 +1,69 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include "ipv4.hh"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace nopticon {
+
+/// Peer in the index table of an MRT TABLE_DUMP_V2 RIB snapshot
+struct mrt_peer_t {
+  ip_addr_t bgp_id;
+  /// Zero if the peer has an IPv6 address
+  ip_addr_t ip_addr;
+};
+
+typedef std::vector<mrt_peer_t> mrt_peers_t;
+
+/// Route of a peer, given by its index in the peer index table
+struct mrt_route_t {
+  ip_prefix_t ip_prefix;
+  uint16_t peer_index;
+  ip_addr_t next_hop;
+};
+
+typedef std::vector<mrt_route_t> mrt_routes_t;
+
+/// Reads the IPv4 unicast routes of a RIB snapshot in the MRT format
+/// (RFC 6396), one RIB record at a time; records of other types and
+/// routes without an IPv4 next hop are skipped
+class mrt_reader_t {
+public:
+  mrt_reader_t(std::FILE *file) : m_file{file} {}
+
+  /// Replaces the routes by those of the next RIB record; false at the
+  /// end of the file or if the file is malformed, see error()
+  bool read(mrt_routes_t &);
+
+  /// Peer index table that the routes refer to
+  const mrt_peers_t &peers() const noexcept { return m_peers; }
+
+  /// Time, in seconds, of the last record
+  uint32_t timestamp() const noexcept { return m_timestamp; }
+
+  std::size_t number_of_skipped_routes() const noexcept {
+    return m_number_of_skipped_routes;
+  }
+
+  /// Empty unless the file is malformed
+  const std::string &error() const noexcept { return m_error; }
+
+private:
+  bool read_peer_index_table();
+  bool read_rib(bool is_add_path, mrt_routes_t &);
+  bool fail(const char *error);
+
+  std::FILE *m_file;
+  std::vector<uint8_t> m_record;
+  mrt_peers_t m_peers;
+  uint32_t m_timestamp = 0;
+  std::size_t m_number_of_skipped_routes = 0;
+  std::string m_error;
+};
+
+} // namespace nopticon
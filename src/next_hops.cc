@@ -0,0 +1,49 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "next_hops.hh"
+
+#include <algorithm>
+
+namespace nopticon {
+
+bool operator==(const next_hops_t &x, const target_t &y) noexcept {
+  return x.size() == y.size() and std::equal(x.begin(), x.end(), y.begin());
+}
+
+std::size_t next_hops_table_t::hash_t::operator()(const target_t &target) const
+    noexcept {
+  uint64_t hash = target.size();
+  for (auto t : target) {
+    hash = (hash ^ t) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+next_hops_t next_hops_table_t::intern(const target_t &target) {
+  assert(target.size() <= UINT32_MAX);
+  next_hops_t next_hops;
+  next_hops.m_size = target.size();
+  if (target.size() == 1) {
+    next_hops.m_nid = target.front();
+  } else if (target.size() > 1) {
+    auto &pair = *m_refcounts.emplace(target, 0).first;
+    ++pair.second;
+    next_hops.m_interned = &pair.first;
+  }
+  return next_hops;
+}
+
+void next_hops_table_t::release(const next_hops_t &next_hops) {
+  if (next_hops.m_interned == nullptr) {
+    return;
+  }
+  auto iter = m_refcounts.find(*next_hops.m_interned);
+  assert(iter != m_refcounts.end());
+  assert(&iter->first == next_hops.m_interned);
+  if (--iter->second == 0) {
+    m_refcounts.erase(iter);
+  }
+}
+
+} // namespace nopticon
@@ -0,0 +1,87 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace nopticon {
+
+typedef uint32_t nid_t;
+typedef std::vector<nid_t> target_t;
+
+/// Immutable sequence of next hops; a single next hop is stored inline
+/// and longer ones are interned by a next_hops_table_t, so that equal
+/// sequences have equal handles
+class next_hops_t {
+public:
+  typedef const nid_t *const_iterator;
+
+  next_hops_t() noexcept : m_interned{nullptr}, m_size{0}, m_nid{0} {}
+
+  const_iterator begin() const noexcept {
+    return m_interned == nullptr ? &m_nid : m_interned->data();
+  }
+  const_iterator end() const noexcept { return begin() + m_size; }
+
+  std::size_t size() const noexcept { return m_size; }
+  bool empty() const noexcept { return m_size == 0; }
+
+  nid_t operator[](std::size_t i) const noexcept {
+    assert(i < m_size);
+    return begin()[i];
+  }
+
+  operator target_t() const { return target_t(begin(), end()); }
+
+  /// Compares handles in constant time
+  bool operator==(const next_hops_t &other) const noexcept {
+    return m_interned == other.m_interned and m_size == other.m_size and
+           m_nid == other.m_nid;
+  }
+  bool operator!=(const next_hops_t &other) const noexcept {
+    return not(*this == other);
+  }
+
+private:
+  friend class next_hops_table_t;
+
+  const target_t *m_interned;
+  uint32_t m_size;
+  nid_t m_nid;
+};
+
+bool operator==(const next_hops_t &, const target_t &) noexcept;
+
+inline bool operator==(const target_t &x, const next_hops_t &y) noexcept {
+  return y == x;
+}
+inline bool operator!=(const next_hops_t &x, const target_t &y) noexcept {
+  return not(x == y);
+}
+inline bool operator!=(const target_t &x, const next_hops_t &y) noexcept {
+  return not(y == x);
+}
+
+/// Reference-counted table of sequences of two or more next hops
+class next_hops_table_t {
+public:
+  /// Each handle must eventually be released exactly once
+  next_hops_t intern(const target_t &);
+  void release(const next_hops_t &);
+
+  /// Number of distinct interned sequences
+  std::size_t size() const noexcept { return m_refcounts.size(); }
+
+private:
+  struct hash_t {
+    std::size_t operator()(const target_t &) const noexcept;
+  };
+
+  std::unordered_map<target_t, uint32_t, hash_t> m_refcounts;
+};
+
+} // namespace nopticon
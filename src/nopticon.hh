@@ -6,3 +6,4 @@
 #define NOPTICON_VERSION "0.0.3"
 
 #include "analysis.hh"
+#include "mrt.hh"
@@ -0,0 +1,224 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace nopticon {
+
+/// Set of unique keys that supports insertion, removal, selection of
+/// the i-th smallest key and counting of smaller keys, each in
+/// expected logarithmic time (randomized balanced binary search tree)
+template <class Key, class Compare = std::less<Key>>
+class order_statistic_tree_t {
+public:
+  order_statistic_tree_t() : m_root{NIL}, m_seed{0x9e3779b97f4a7c15ULL} {}
+
+  std::size_t size() const noexcept { return size(m_root); }
+  bool empty() const noexcept { return m_root == NIL; }
+
+  /// Returns true if the key has been inserted; false if it existed
+  bool insert(const Key &);
+
+  /// Returns true if the key existed; false otherwise
+  bool erase(const Key &);
+
+  /// Number of keys that are strictly less than the given one
+  std::size_t count_less(const Key &) const;
+
+  /// i-th smallest key, starting at zero
+  const Key &at(std::size_t) const;
+
+  void clear() noexcept {
+    m_nodes.clear();
+    m_free.clear();
+    m_root = NIL;
+  }
+
+private:
+  typedef uint32_t node_id_t;
+  static constexpr node_id_t NIL = UINT32_MAX;
+
+  struct node_t {
+    Key key;
+    uint64_t priority;
+    std::size_t size;
+    node_id_t left, right;
+  };
+
+  std::vector<node_t> m_nodes;
+  std::vector<node_id_t> m_free;
+  std::vector<node_id_t> m_path;
+  node_id_t m_root;
+  uint64_t m_seed;
+  Compare m_less;
+
+  std::size_t size(node_id_t n) const noexcept {
+    return n == NIL ? 0 : m_nodes[n].size;
+  }
+
+  void update_size(node_id_t n) noexcept {
+    m_nodes[n].size = 1 + size(m_nodes[n].left) + size(m_nodes[n].right);
+  }
+
+  uint64_t next_priority() noexcept {
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 7;
+    m_seed ^= m_seed << 17;
+    return m_seed;
+  }
+
+  /// Keys strictly less than the given one go left, the others right
+  void split(node_id_t, const Key &, node_id_t &, node_id_t &);
+
+  /// Every key in the left tree is less than every key in the right one
+  node_id_t merge(node_id_t, node_id_t);
+};
+
+template <class Key, class Compare>
+constexpr typename order_statistic_tree_t<Key, Compare>::node_id_t
+    order_statistic_tree_t<Key, Compare>::NIL;
+
+template <class Key, class Compare>
+void order_statistic_tree_t<Key, Compare>::split(node_id_t n, const Key &key,
+                                                 node_id_t &left,
+                                                 node_id_t &right) {
+  if (n == NIL) {
+    left = right = NIL;
+    return;
+  }
+  if (m_less(m_nodes[n].key, key)) {
+    split(m_nodes[n].right, key, m_nodes[n].right, right);
+    left = n;
+  } else {
+    split(m_nodes[n].left, key, left, m_nodes[n].left);
+    right = n;
+  }
+  update_size(n);
+}
+
+template <class Key, class Compare>
+typename order_statistic_tree_t<Key, Compare>::node_id_t
+order_statistic_tree_t<Key, Compare>::merge(node_id_t left, node_id_t right) {
+  if (left == NIL) {
+    return right;
+  }
+  if (right == NIL) {
+    return left;
+  }
+  if (m_nodes[left].priority > m_nodes[right].priority) {
+    m_nodes[left].right = merge(m_nodes[left].right, right);
+    update_size(left);
+    return left;
+  }
+  m_nodes[right].left = merge(left, m_nodes[right].left);
+  update_size(right);
+  return right;
+}
+
+template <class Key, class Compare>
+bool order_statistic_tree_t<Key, Compare>::insert(const Key &key) {
+  for (auto n = m_root; n != NIL;) {
+    auto &node = m_nodes[n];
+    if (m_less(key, node.key)) {
+      n = node.left;
+    } else if (m_less(node.key, key)) {
+      n = node.right;
+    } else {
+      return false;
+    }
+  }
+  node_id_t n;
+  if (m_free.empty()) {
+    assert(m_nodes.size() < NIL);
+    n = m_nodes.size();
+    m_nodes.push_back({key, next_priority(), 1, NIL, NIL});
+  } else {
+    n = m_free.back();
+    m_free.pop_back();
+    m_nodes[n] = {key, next_priority(), 1, NIL, NIL};
+  }
+  node_id_t left, right;
+  split(m_root, key, left, right);
+  m_root = merge(merge(left, n), right);
+  return true;
+}
+
+template <class Key, class Compare>
+bool order_statistic_tree_t<Key, Compare>::erase(const Key &key) {
+  // path from the root so that sizes can be updated afterwards
+  auto &path = m_path;
+  path.clear();
+  auto n = m_root;
+  while (n != NIL) {
+    auto &node = m_nodes[n];
+    if (m_less(key, node.key)) {
+      path.push_back(n);
+      n = node.left;
+    } else if (m_less(node.key, key)) {
+      path.push_back(n);
+      n = node.right;
+    } else {
+      break;
+    }
+  }
+  if (n == NIL) {
+    return false;
+  }
+  auto subtree = merge(m_nodes[n].left, m_nodes[n].right);
+  if (path.empty()) {
+    m_root = subtree;
+  } else {
+    auto &parent = m_nodes[path.back()];
+    if (parent.left == n) {
+      parent.left = subtree;
+    } else {
+      parent.right = subtree;
+    }
+  }
+  for (auto iter = path.rbegin(); iter != path.rend(); ++iter) {
+    --m_nodes[*iter].size;
+  }
+  m_free.push_back(n);
+  return true;
+}
+
+template <class Key, class Compare>
+std::size_t
+order_statistic_tree_t<Key, Compare>::count_less(const Key &key) const {
+  std::size_t count = 0;
+  for (auto n = m_root; n != NIL;) {
+    auto &node = m_nodes[n];
+    if (m_less(node.key, key)) {
+      count += size(node.left) + 1;
+      n = node.right;
+    } else {
+      n = node.left;
+    }
+  }
+  return count;
+}
+
+template <class Key, class Compare>
+const Key &order_statistic_tree_t<Key, Compare>::at(std::size_t i) const {
+  assert(i < size());
+  auto n = m_root;
+  for (;;) {
+    auto &node = m_nodes[n];
+    auto left_size = size(node.left);
+    if (i < left_size) {
+      n = node.left;
+    } else if (i == left_size) {
+      return node.key;
+    } else {
+      i -= left_size + 1;
+      n = node.right;
+    }
+  }
+}
+
+} // namespace nopticon
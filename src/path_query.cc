@@ -0,0 +1,195 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "path_query.hh"
+
+#include <algorithm>
+#include <tuple>
+
+namespace nopticon {
+
+constexpr uint32_t path_query_t::NONE;
+
+path_query_t::path_query_t(std::size_t number_of_nodes)
+    : m_flow{nullptr}, m_source{0}, m_order(number_of_nodes, NONE),
+      m_predecessors(number_of_nodes), m_idom(number_of_nodes, NONE),
+      m_pre(number_of_nodes), m_post(number_of_nodes) {}
+
+const next_hops_t &path_query_t::target(nid_t n) const {
+  static const next_hops_t s_no_target;
+  auto iter = m_flow->data.find(n);
+  if (iter == m_flow->data.end()) {
+    return s_no_target;
+  }
+  return iter->second->target;
+}
+
+void path_query_t::build(const_flow_t flow, source_t source) {
+  assert(flow != nullptr);
+  assert(source < m_order.size());
+  for (auto n : m_nodes) {
+    m_order[n] = NONE;
+    m_idom[n] = NONE;
+    m_predecessors[n].clear();
+  }
+  m_nodes.clear();
+  m_flow = flow;
+  m_source = source;
+
+  // iterative depth-first search where each frame is a node, its next
+  // hops and the position of the next one to visit
+  std::vector<std::tuple<nid_t, const next_hops_t *, std::size_t>> stack;
+  m_order[source] = 0;
+  stack.emplace_back(source, &target(source), 0);
+  while (not stack.empty()) {
+    auto &frame = stack.back();
+    auto n = std::get<0>(frame);
+    auto &next_hops = *std::get<1>(frame);
+    auto &i = std::get<2>(frame);
+    if (i == next_hops.size()) {
+      m_nodes.push_back(n);
+      stack.pop_back();
+      continue;
+    }
+    auto t = next_hops[i++];
+    assert(t < m_order.size());
+    m_predecessors[t].push_back(n);
+    if (m_order[t] == NONE) {
+      m_order[t] = 0;
+      stack.emplace_back(t, &target(t), 0);
+    }
+  }
+  std::reverse(m_nodes.begin(), m_nodes.end());
+  for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+    m_order[m_nodes[i]] = i;
+  }
+
+  m_idom[source] = source;
+  for (bool is_changed = true; is_changed;) {
+    is_changed = false;
+    for (std::size_t i = 1; i < m_nodes.size(); ++i) {
+      auto n = m_nodes[i];
+      auto idom = NONE;
+      for (auto p : m_predecessors[n]) {
+        if (m_idom[p] != NONE) {
+          idom = idom == NONE ? p : intersect(p, idom);
+        }
+      }
+      assert(idom != NONE);
+      if (m_idom[n] != idom) {
+        m_idom[n] = idom;
+        is_changed = true;
+      }
+    }
+  }
+  number_dominator_tree();
+}
+
+nid_t path_query_t::intersect(nid_t x, nid_t y) const {
+  while (x != y) {
+    while (m_order[x] > m_order[y]) {
+      x = m_idom[x];
+    }
+    while (m_order[y] > m_order[x]) {
+      y = m_idom[y];
+    }
+  }
+  return x;
+}
+
+void path_query_t::number_dominator_tree() {
+  // children of each node in the dominator tree, grouped by parent
+  auto size = m_nodes.size();
+  std::vector<uint32_t> begin(size + 1, 0), children(size);
+  for (std::size_t i = 1; i < size; ++i) {
+    ++begin[m_order[m_idom[m_nodes[i]]] + 1];
+  }
+  for (std::size_t i = 0; i < size; ++i) {
+    begin[i + 1] += begin[i];
+  }
+  std::vector<uint32_t> end(begin.begin(), begin.end() - 1);
+  for (uint32_t i = 1; i < size; ++i) {
+    children[end[m_order[m_idom[m_nodes[i]]]]++] = i;
+  }
+
+  uint32_t counter = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  m_pre[m_source] = counter++;
+  stack.emplace_back(0, begin[0]);
+  while (not stack.empty()) {
+    auto i = stack.back().first;
+    auto &next = stack.back().second;
+    if (next == begin[i + 1]) {
+      m_post[m_nodes[i]] = counter++;
+      stack.pop_back();
+      continue;
+    }
+    auto child = children[next++];
+    m_pre[m_nodes[child]] = counter++;
+    stack.emplace_back(child, begin[child]);
+  }
+}
+
+path_t path_query_t::waypoints(nid_t t) const {
+  path_t path;
+  if (not is_reachable(t)) {
+    return path;
+  }
+  for (; t != m_source; t = m_idom[t]) {
+    path.push_back(t);
+  }
+  path.push_back(m_source);
+  std::reverse(path.begin(), path.end());
+  return path;
+}
+
+paths_t path_query_t::paths(nid_t t, std::size_t max_paths) const {
+  paths_t paths;
+  if (not is_reachable(t) or max_paths == 0) {
+    return paths;
+  }
+
+  // only nodes from which t is reachable can be on a path to t
+  std::vector<bool> is_relevant(m_order.size());
+  std::vector<nid_t> stack{t};
+  is_relevant[t] = true;
+  while (not stack.empty()) {
+    auto n = stack.back();
+    stack.pop_back();
+    for (auto p : m_predecessors[n]) {
+      if (not is_relevant[p]) {
+        is_relevant[p] = true;
+        stack.push_back(p);
+      }
+    }
+  }
+
+  std::vector<bool> is_on_path(m_order.size());
+  std::vector<std::pair<const next_hops_t *, std::size_t>> frames;
+  path_t path{m_source};
+  is_on_path[m_source] = true;
+  frames.emplace_back(&target(m_source), 0);
+  while (not frames.empty() and paths.size() < max_paths) {
+    auto n = path.back();
+    auto &next_hops = *frames.back().first;
+    auto &i = frames.back().second;
+    if (n == t or i == next_hops.size()) {
+      if (n == t) {
+        paths.push_back(path);
+      }
+      is_on_path[n] = false;
+      path.pop_back();
+      frames.pop_back();
+      continue;
+    }
+    auto w = next_hops[i++];
+    if (is_relevant[w] and not is_on_path[w]) {
+      is_on_path[w] = true;
+      path.push_back(w);
+      frames.emplace_back(&target(w), 0);
+    }
+  }
+  return paths;
+}
+
+} // namespace nopticon
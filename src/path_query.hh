@@ -0,0 +1,68 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include "flow_graph.hh"
+
+namespace nopticon {
+
+typedef std::vector<nid_t> path_t;
+typedef std::vector<path_t> paths_t;
+
+/// Dominator tree of the forwarding graph of a flow, rooted at a source,
+/// to answer waypoint and path queries; it is computed on demand in
+/// near-linear time (Cooper, Harvey and Kennedy's iterative algorithm)
+class path_query_t {
+public:
+  path_query_t(std::size_t number_of_nodes);
+
+  /// Results are valid until the next build
+  void build(const_flow_t, source_t);
+
+  /// Whether t is reachable from the source in zero or more hops
+  bool is_reachable(nid_t t) const noexcept {
+    assert(t < m_order.size());
+    return m_order[t] != NONE;
+  }
+
+  /// Whether every forwarding path from the source to t goes through w;
+  /// false if t is not reachable
+  bool is_waypoint(nid_t w, nid_t t) const noexcept {
+    assert(w < m_order.size());
+    if (not is_reachable(w) or not is_reachable(t)) {
+      return false;
+    }
+    return m_pre[w] <= m_pre[t] and m_post[t] <= m_post[w];
+  }
+
+  /// Nodes that every forwarding path from the source to t goes through,
+  /// in the order of the paths, including the source and t itself
+  path_t waypoints(nid_t t) const;
+
+  /// Up to the given number of loop-free forwarding paths to t
+  paths_t paths(nid_t t, std::size_t max_paths) const;
+
+private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  const_flow_t m_flow;
+  source_t m_source;
+
+  // reverse postorder of the reachable nodes, and each node's position
+  // in it; m_order is NONE for unreachable nodes
+  std::vector<nid_t> m_nodes;
+  std::vector<uint32_t> m_order;
+  std::vector<std::vector<nid_t>> m_predecessors;
+
+  // immediate dominator of each node, and the interval of each node in
+  // a depth-first search of the dominator tree
+  std::vector<nid_t> m_idom;
+  std::vector<uint32_t> m_pre, m_post;
+
+  const next_hops_t &target(nid_t) const;
+  nid_t intersect(nid_t, nid_t) const;
+  void number_dominator_tree();
+};
+
+} // namespace nopticon
@@ -0,0 +1,107 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "policy.hh"
+
+namespace nopticon {
+
+policy_id_t policy_monitor_t::insert(const policy_t &policy,
+                                     const flow_graph_t &flow_graph) {
+  assert(not policy.paths.empty());
+  policy_id_t id = m_policies.size();
+  m_policies.push_back(policy);
+  auto flow = flow_graph.flow_tree().find(policy.ip_prefix);
+  m_holds.push_back(check(policy, flow));
+  m_policies_per_ip_prefix[policy.ip_prefix].push_back(id);
+  return id;
+}
+
+void policy_monitor_t::update(const affected_flows_t &affected_flows) {
+  m_events.clear();
+  if (m_policies.empty()) {
+    return;
+  }
+  for (auto flow : affected_flows) {
+    auto iter = m_policies_per_ip_prefix.find(flow->ip_prefix);
+    if (iter == m_policies_per_ip_prefix.end()) {
+      continue;
+    }
+    for (auto id : iter->second) {
+      bool holds = check(m_policies[id], flow);
+      if (holds != m_holds[id]) {
+        m_holds[id] = holds;
+        m_events.push_back({id, holds});
+      }
+    }
+  }
+}
+
+bool policy_monitor_t::check(const policy_t &policy, const_flow_t flow) {
+  auto &path = policy.paths.front();
+  if (path.size() < 2) {
+    return true;
+  }
+  if (flow == nullptr) {
+    return false;
+  }
+  switch (policy.type) {
+  case policy_type_t::REACHABILITY:
+    return is_reachable(flow, path.front(), path.back());
+  case policy_type_t::WAYPOINT:
+    // the first and last node are waypoints exactly if t is reachable
+    m_path_query.build(flow, path.front());
+    for (auto w : path) {
+      if (not m_path_query.is_waypoint(w, path.back())) {
+        return false;
+      }
+    }
+    return true;
+  case policy_type_t::PATH_PREFERENCE:
+    for (std::size_t i = 0; i + 1 < path.size(); ++i) {
+      auto iter = flow->data.find(path[i]);
+      if (iter == flow->data.end()) {
+        return false;
+      }
+      auto &target = iter->second->target;
+      if (std::find(target.begin(), target.end(), path[i + 1]) ==
+          target.end()) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+bool policy_monitor_t::is_reachable(const_flow_t flow, nid_t s, nid_t t) {
+  assert(s < m_visited.size() and t < m_visited.size());
+  if (s == t) {
+    return true;
+  }
+  assert(m_stack.empty());
+  std::fill(m_visited.begin(), m_visited.end(), false);
+  m_visited[s] = true;
+  m_stack.push_back(s);
+  while (not m_stack.empty()) {
+    auto n = m_stack.back();
+    m_stack.pop_back();
+    auto iter = flow->data.find(n);
+    if (iter == flow->data.end()) {
+      continue;
+    }
+    for (auto target : iter->second->target) {
+      if (target == t) {
+        m_stack.clear();
+        return true;
+      }
+      if (m_visited[target]) {
+        continue;
+      }
+      m_visited[target] = true;
+      m_stack.push_back(target);
+    }
+  }
+  return false;
+}
+
+} // namespace nopticon
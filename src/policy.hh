@@ -0,0 +1,73 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include "flow_graph.hh"
+#include "path_query.hh"
+
+namespace nopticon {
+
+enum class policy_type_t : uint8_t {
+  /// Last node of the path is reachable from its first
+  REACHABILITY = 0,
+  /// Reachability such that every forwarding path from the first to
+  /// the last node goes through each intermediate node of the path
+  WAYPOINT,
+  /// The flow is forwarded along the first path, in order of
+  /// preference; the other paths are less preferred alternatives
+  PATH_PREFERENCE
+};
+
+/// Intent about the flow whose IP prefix is exactly the given one
+struct policy_t {
+  policy_type_t type;
+  ip_prefix_t ip_prefix;
+  paths_t paths;
+};
+
+typedef std::size_t policy_id_t;
+
+/// Change of whether a policy holds
+struct policy_event_t {
+  policy_id_t policy_id;
+  bool holds;
+};
+
+typedef std::vector<policy_event_t> policy_events_t;
+
+/// Incrementally checks policies against the flows affected by updates
+class policy_monitor_t {
+public:
+  policy_monitor_t(std::size_t number_of_nodes)
+      : m_visited(number_of_nodes), m_path_query(number_of_nodes) {}
+
+  /// Whether the policy holds is initially checked against the flow graph
+  policy_id_t insert(const policy_t &, const flow_graph_t &);
+
+  /// Re-checks only policies about the affected flows
+  void update(const affected_flows_t &);
+
+  const policy_t &policy(policy_id_t id) const { return m_policies.at(id); }
+  std::size_t size() const noexcept { return m_policies.size(); }
+  bool holds(policy_id_t id) const { return m_holds.at(id); }
+
+  /// Policies that started or stopped to hold in the most recent update
+  const policy_events_t &events() const noexcept { return m_events; }
+
+private:
+  std::vector<policy_t> m_policies;
+  std::vector<bool> m_holds;
+  ip_prefix_map_t<std::vector<policy_id_t>> m_policies_per_ip_prefix;
+  policy_events_t m_events;
+
+  // scratch space for graph searches
+  std::vector<bool> m_visited;
+  std::vector<nid_t> m_stack;
+  path_query_t m_path_query;
+
+  bool check(const policy_t &, const_flow_t);
+  bool is_reachable(const_flow_t, nid_t, nid_t);
+};
+
+} // namespace nopticon
@@ -0,0 +1,275 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "what_if.hh"
+
+#include <iterator>
+#include <set>
+#include <tuple>
+
+namespace nopticon {
+
+static ip_prefix_t make_ip_prefix(const ip_prefix_t &ip_prefix, unsigned len) {
+  if (len == 0) {
+    return {};
+  }
+  ip_prefix_t result{0, static_cast<uint8_t>(len)};
+  result.ip_addr = ip_prefix.ip_addr & ~result.mask;
+  return result;
+}
+
+void what_if_t::insert_or_assign(const ip_prefix_t &ip_prefix, source_t source,
+                                 const target_t &target) {
+  m_overlay[{source, ip_prefix}] = {false, target};
+}
+
+void what_if_t::erase(const ip_prefix_t &ip_prefix, source_t source) {
+  m_overlay[{source, ip_prefix}] = {true, {}};
+}
+
+void what_if_t::drop(const ip_prefix_t &ip_prefix, source_t source,
+                     const target_t &target, nid_t nid) {
+  if (source == nid) {
+    erase(ip_prefix, source);
+    return;
+  }
+  if (std::find(target.begin(), target.end(), nid) == target.end()) {
+    return;
+  }
+  target_t new_target;
+  for (auto t : target) {
+    if (t != nid) {
+      new_target.push_back(t);
+    }
+  }
+  if (new_target.empty()) {
+    erase(ip_prefix, source);
+  } else {
+    insert_or_assign(ip_prefix, source, new_target);
+  }
+}
+
+void what_if_t::fail(nid_t nid) {
+  std::vector<std::tuple<ip_prefix_t, source_t, target_t>> rules;
+  for (auto &pair : m_overlay) {
+    if (not pair.second.first) {
+      rules.emplace_back(pair.first.second, pair.first.first,
+                         pair.second.second);
+    }
+  }
+  // every rule forwards at least the flow of its own IP prefix
+  for (auto &pair : m_analysis.flow_graph().node_flows(nid)) {
+    for (auto &data : pair.first->data) {
+      auto &rule = *data.second;
+      if (m_overlay.count({rule.source, rule.ip_prefix}) == 0) {
+        rules.emplace_back(rule.ip_prefix, rule.source, rule.target);
+      }
+    }
+  }
+  for (auto &rule : rules) {
+    drop(std::get<0>(rule), std::get<1>(rule), std::get<2>(rule), nid);
+  }
+}
+
+bool what_if_t::lookup(const ip_prefix_t &ip_prefix, source_t source,
+                       target_t &target) const {
+  auto &flow_graph = m_analysis.flow_graph();
+  auto len = ip_prefix_length(ip_prefix);
+  for (;;) {
+    auto p = make_ip_prefix(ip_prefix, len);
+    auto overlay_iter = m_overlay.find({source, p});
+    if (overlay_iter != m_overlay.end()) {
+      if (not overlay_iter->second.first) {
+        target = overlay_iter->second.second;
+        return true;
+      }
+    } else {
+      auto rule_ref = flow_graph.find(p, source);
+      if (rule_ref != nullptr) {
+        target = rule_ref->target;
+        return true;
+      }
+    }
+    if (len == 0) {
+      return false;
+    }
+    --len;
+  }
+}
+
+static forwarding_t make_forwarding(const_flow_t flow) {
+  forwarding_t forwarding;
+  for (auto &pair : flow->data) {
+    forwarding.emplace(pair.first, pair.second->target);
+  }
+  return forwarding;
+}
+
+forwarding_t what_if_t::make_hypothetical_forwarding(
+    const ip_prefix_t &ip_prefix, const forwarding_t &forwarding,
+    const std::vector<source_t> &overlay_sources) const {
+  forwarding_t hypothetical_forwarding;
+  target_t target;
+  auto update = [&](source_t source) {
+    if (hypothetical_forwarding.count(source) == 0 and
+        lookup(ip_prefix, source, target)) {
+      hypothetical_forwarding.emplace(source, target);
+    }
+  };
+  for (auto &pair : forwarding) {
+    update(pair.first);
+  }
+  for (auto source : overlay_sources) {
+    update(source);
+  }
+  return hypothetical_forwarding;
+}
+
+static void insert_subtree(const_flow_t flow,
+                           ip_prefix_map_t<std::pair<const_flow_t,
+                                                     const_flow_t>> &flows) {
+  auto flow_iter = flow->iter();
+  do {
+    auto descendant = flow_iter.ptr();
+    flows.emplace(descendant->ip_prefix, std::make_pair(descendant, descendant));
+  } while (flow_iter.next());
+}
+
+static edges_t difference(const edges_t &a, const edges_t &b) {
+  edges_t c;
+  std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+                      std::back_inserter(c));
+  return c;
+}
+
+what_if_flows_t what_if_t::diff() const {
+  auto &flow_tree = m_analysis.flow_graph().flow_tree();
+  std::vector<source_t> overlay_sources;
+  // each IP prefix maps to its flow, if any, and its current forwarding
+  ip_prefix_map_t<std::pair<const_flow_t, const_flow_t>> flows;
+  for (auto &pair : m_overlay) {
+    auto source = pair.first.first;
+    auto &ip_prefix = pair.first.second;
+    if (overlay_sources.empty() or overlay_sources.back() != source) {
+      overlay_sources.push_back(source);
+    }
+    auto flow = flow_tree.find(ip_prefix);
+    if (flow != nullptr) {
+      insert_subtree(flow, flows);
+      continue;
+    }
+    const_flow_t base = &flow_tree;
+    for (bool is_done = false; not is_done;) {
+      is_done = true;
+      for (auto &child : base->children()) {
+        if (subset(ip_prefix, child.first)) {
+          base = child.second;
+          is_done = false;
+          break;
+        }
+      }
+    }
+    flows.emplace(ip_prefix, std::make_pair(nullptr, base));
+    for (auto &child : base->children()) {
+      if (subset(child.first, ip_prefix)) {
+        insert_subtree(child.second, flows);
+      }
+    }
+  }
+  what_if_flows_t what_if_flows;
+  for (auto &pair : flows) {
+    auto base = pair.second.second;
+    auto forwarding = make_forwarding(base);
+    auto hypothetical_forwarding =
+        make_hypothetical_forwarding(pair.first, forwarding, overlay_sources);
+    if (forwarding == hypothetical_forwarding) {
+      continue;
+    }
+    auto reach = find_reach(forwarding);
+    auto hypothetical_reach = find_reach(hypothetical_forwarding);
+    what_if_flows.push_back({pair.first, pair.second.first, base,
+                             std::move(forwarding),
+                             std::move(hypothetical_forwarding),
+                             {}, {},
+                             difference(hypothetical_reach, reach),
+                             difference(reach, hypothetical_reach)});
+    auto &what_if_flow = what_if_flows.back();
+    what_if_flow.loops = find_loops(what_if_flow.forwarding);
+    what_if_flow.hypothetical_loops =
+        find_loops(what_if_flow.hypothetical_forwarding);
+  }
+  return what_if_flows;
+}
+
+loops_t find_loops(const forwarding_t &forwarding) {
+  enum : uint8_t { WHITE = 0, GRAY, BLACK };
+  std::map<nid_t, uint8_t> color;
+  std::set<loop_t> loops;
+  // depth-first search where each entry is a node and its next target
+  std::vector<std::pair<nid_t, std::size_t>> stack;
+  for (auto &pair : forwarding) {
+    if (color[pair.first] != WHITE) {
+      continue;
+    }
+    color[pair.first] = GRAY;
+    stack.emplace_back(pair.first, 0);
+    while (not stack.empty()) {
+      auto n = stack.back().first;
+      auto &i = stack.back().second;
+      auto iter = forwarding.find(n);
+      if (iter == forwarding.end() or i == iter->second.size()) {
+        color[n] = BLACK;
+        stack.pop_back();
+        continue;
+      }
+      auto t = iter->second[i++];
+      auto &t_color = color[t];
+      if (t_color == WHITE) {
+        t_color = GRAY;
+        stack.emplace_back(t, 0);
+      } else if (t_color == GRAY) {
+        loop_t loop;
+        auto stack_iter = stack.end();
+        do {
+          --stack_iter;
+          loop.push_back(stack_iter->first);
+        } while (stack_iter->first != t);
+        std::reverse(loop.begin(), loop.end());
+        std::rotate(loop.begin(), std::min_element(loop.begin(), loop.end()),
+                    loop.end());
+        loops.insert(std::move(loop));
+      }
+    }
+  }
+  return loops_t(loops.begin(), loops.end());
+}
+
+edges_t find_reach(const forwarding_t &forwarding) {
+  edges_t reach;
+  std::set<nid_t> seen;
+  std::vector<nid_t> stack;
+  for (auto &pair : forwarding) {
+    auto s = pair.first;
+    stack.push_back(s);
+    while (not stack.empty()) {
+      auto n = stack.back();
+      stack.pop_back();
+      auto iter = forwarding.find(n);
+      if (iter == forwarding.end()) {
+        continue;
+      }
+      for (auto t : iter->second) {
+        if (seen.insert(t).second) {
+          stack.push_back(t);
+        }
+      }
+    }
+    for (auto t : seen) {
+      reach.emplace_back(s, t);
+    }
+    seen.clear();
+  }
+  return reach;
+}
+
+} // namespace nopticon
@@ -0,0 +1,88 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#pragma once
+
+#include "analysis.hh"
+
+#include <map>
+
+namespace nopticon {
+
+/// Next hops of each source, ordered by source
+typedef std::map<source_t, target_t> forwarding_t;
+
+typedef std::pair<nid_t, nid_t> edge_t;
+typedef std::vector<edge_t> edges_t;
+
+/// How the forwarding of a flow would change
+struct what_if_flow_t {
+  ip_prefix_t ip_prefix;
+  /// Flow in the analysis; nullptr if the flow would be new, in which
+  /// case its addresses are currently forwarded as the `base` flow
+  const_flow_t flow;
+  const_flow_t base;
+  forwarding_t forwarding, hypothetical_forwarding;
+  loops_t loops, hypothetical_loops;
+  /// (s, t) such that t would become, or no longer be, reachable from s
+  edges_t gained_reach, lost_reach;
+};
+
+typedef std::vector<what_if_flow_t> what_if_flows_t;
+
+/// Hypothetical changes to the rules of an analysis, which itself is
+/// left untouched. Only the changes are stored, so forking is cheap;
+/// the analysis must not be updated while the fork is in use.
+class what_if_t {
+public:
+  what_if_t(const analysis_t &analysis) : m_analysis(analysis) {}
+
+  void insert_or_assign(const ip_prefix_t &, source_t, const target_t &);
+  void erase(const ip_prefix_t &, source_t);
+
+  /// Erase all rules of the node and no longer forward to it
+  void fail(nid_t);
+
+  bool empty() const noexcept { return m_overlay.empty(); }
+
+  /// Flows whose forwarding would change, in IP prefix order
+  what_if_flows_t diff() const;
+
+private:
+  struct rule_key_order_t {
+    ip_prefix_order_t ip_prefix_order;
+    bool operator()(const std::pair<source_t, ip_prefix_t> &x,
+                    const std::pair<source_t, ip_prefix_t> &y) const {
+      if (x.first == y.first) {
+        return ip_prefix_order(x.second, y.second);
+      }
+      return x.first < y.first;
+    }
+  };
+
+  // first is true if the rule is erased, second are its next hops
+  typedef std::map<std::pair<source_t, ip_prefix_t>,
+                   std::pair<bool, target_t>, rule_key_order_t>
+      overlay_t;
+
+  const analysis_t &m_analysis;
+  overlay_t m_overlay;
+
+  /// Next hops of a source for the flow whose IP prefix is given
+  bool lookup(const ip_prefix_t &, source_t, target_t &) const;
+
+  /// Changes the rule so that it no longer forwards to the node
+  void drop(const ip_prefix_t &, source_t, const target_t &, nid_t);
+
+  forwarding_t make_hypothetical_forwarding(const ip_prefix_t &,
+                                            const forwarding_t &,
+                                            const std::vector<source_t> &) const;
+};
+
+/// Each forwarding loop, starting at its smallest node
+loops_t find_loops(const forwarding_t &);
+
+/// Each (s, t) such that t is reachable from s, in increasing order
+edges_t find_reach(const forwarding_t &);
+
+} // namespace nopticon
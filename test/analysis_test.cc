@@ -6,7 +6,9 @@
 
 #include <analysis.hh>
 
+#include <map>
 #include <random>
+#include <set>
 
 using namespace nopticon;
 
@@ -234,6 +236,163 @@ static void test_loop() {
   assert(loop == loop_t({a, b, c}));
 }
 
+//   a  ->  c
+//  ^ |    ^ |
+//  | V    | V
+//   b  <-  d
+static void test_loop_with_ecmp() {
+  const ip_addr_t a{0}, b{1}, c{2}, d{3};
+  analysis_t analysis{4};
+  analysis.insert_or_assign(ip_prefix_0_15, b, {a});
+  analysis.insert_or_assign(ip_prefix_0_15, c, {d});
+  analysis.insert_or_assign(ip_prefix_0_15, d, {b});
+  assert(analysis.ok());
+  analysis.insert_or_assign(ip_prefix_0_15, a, {b, c});
+  assert(not analysis.ok());
+  auto &flow_tree = analysis.flow_graph().flow_tree();
+  auto flow = flow_tree.find(ip_prefix_0_15);
+  // one loop per back edge in the depth-first search from a
+  assert(analysis.loops_per_flow().at(flow) == loops_t({{a, b}}));
+
+  // the path into a loop is not part of it
+  analysis.insert_or_assign(ip_prefix_0_15, a, {b});
+  analysis.insert_or_assign(ip_prefix_0_15, c, {a});
+  assert(analysis.loops_per_flow().at(flow) == loops_t({{a, b}}));
+}
+
+static void test_equivalence_classes() {
+  const ip_addr_t a{0}, b{1}, c{2}, d{3};
+  analysis_t analysis{4};
+  analysis.insert_or_assign(ip_prefix_64_127, c, {d}, 1);
+  analysis.insert_or_assign(ip_prefix_128_143, c, {d}, 2);
+  analysis.insert_or_assign(ip_prefix_0_255, a, {b}, 3);
+  analysis.insert_or_assign(ip_prefix_0_255, b, {a}, 4);
+
+  auto &flow_graph = analysis.flow_graph();
+  auto x = flow_graph.flow_tree().find(ip_prefix_64_127);
+  auto y = flow_graph.flow_tree().find(ip_prefix_128_143);
+  assert(flow_graph.equivalence_class(x) == const_flows_t({x, y}));
+  assert(flow_graph.number_of_equivalence_classes() == 2);
+
+  // flows of an equivalence class share their check, but not histories
+  assert(analysis.loops_per_flow().size() == 3);
+  assert(analysis.loops_per_flow().at(x) == loops_t({{a, b}}));
+  assert(analysis.loops_per_flow().at(y) == loops_t({{a, b}}));
+  auto &reach_summary = analysis.reach_summary();
+  assert(reach_summary.started(x->id) == reach_summary.started(y->id));
+  assert(reach_summary.history(x->id, c, d).time_window() !=
+         reach_summary.history(y->id, c, d).time_window());
+
+  analysis.insert_or_assign(ip_prefix_128_143, c, {a}, 5);
+  assert(flow_graph.equivalence_class(x) == const_flows_t({x}));
+  assert(flow_graph.number_of_equivalence_classes() == 3);
+}
+
+static void test_erase_source() {
+  const ip_addr_t a{0}, b{1}, c{2}, d{3};
+  const spans_t spans{10};
+  analysis_t x{spans, 4}, y{spans, 4};
+  for (auto analysis : {&x, &y}) {
+    analysis->insert_or_assign(ip_prefix_0_255, a, {b}, 1);
+    analysis->insert_or_assign(ip_prefix_64_127, a, {b, c}, 2);
+    analysis->insert_or_assign(ip_prefix_64_79, a, {d}, 3);
+    analysis->insert_or_assign(ip_prefix_0_255, b, {a}, 4);
+    analysis->insert_or_assign(ip_prefix_96_127, c, {d}, 5);
+  }
+  assert(not x.ok());
+
+  // same as withdrawing the rules one at a time
+  assert(x.erase_source(a, 6) == 3);
+  std::vector<ip_prefix_t> ip_prefixes;
+  for (auto &pair : y.flow_graph().rules(a)) {
+    ip_prefixes.push_back(pair.second.ip_prefix);
+  }
+  for (auto &ip_prefix : ip_prefixes) {
+    y.erase(ip_prefix, a, 6);
+  }
+  assert(x.flow_graph().rules(a).empty());
+  assert(x.flow_graph().number_of_rules() == 2);
+  assert(diff(x.flow_graph(), y.flow_graph()).empty());
+  assert(x.ok() and y.ok());
+  assert(x.blackholes_per_flow().size() == y.blackholes_per_flow().size());
+  auto flow = x.flow_graph().flow_tree().find(ip_prefix_64_79);
+  assert(x.reach_summary().history(flow->id, a, d).time_window() ==
+         y.reach_summary().history(flow->id, a, d).time_window());
+  check_duration(x.reach_summary().history(flow->id, a, d).slices(), 3);
+  assert(x.erase_source(a, 7) == 0);
+  assert(x.erase_source(d, 7) == 0);
+}
+
+static std::map<ip_prefix_t, std::set<flow_id_t>, ip_prefix_order_t>
+flows_per_rule(const flow_graph_t &flow_graph, source_t source) {
+  std::map<ip_prefix_t, std::set<flow_id_t>, ip_prefix_order_t> result;
+  for (auto &pair : flow_graph.rules(source)) {
+    auto &flow_ids = result[pair.second.ip_prefix];
+    for (auto flow : pair.second.flows) {
+      flow_ids.insert(flow->id);
+    }
+  }
+  return result;
+}
+
+static void test_sort_routes() {
+  const ip_addr_t a{0}, b{1};
+  routes_t routes{{ip_prefix_64_79, {a}},
+                  {ip_prefix_0_255, {a}},
+                  {ip_prefix_64_79, {b}},
+                  {ip_prefix_64_127, {a, b}}};
+  sort_routes(routes);
+  assert(routes == routes_t({{ip_prefix_0_255, {a}},
+                             {ip_prefix_64_127, {a, b}},
+                             {ip_prefix_64_79, {b}}}));
+}
+
+// same as inserting or assigning the routes one at a time
+static void test_bulk_insert() {
+  constexpr std::size_t number_of_nodes = 5;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<nid_t> node_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<unsigned> len_dist(1, 6);
+  std::uniform_int_distribution<ip_addr_t> addr_dist(0, 255);
+  auto random_route = [&]() -> route_t {
+    auto len = len_dist(gen) * 4;
+    ip_prefix_t ip_prefix{addr_dist(gen) << 24, static_cast<uint8_t>(len)};
+    ip_prefix.ip_addr &= ~ip_prefix.mask;
+    return {ip_prefix, {node_dist(gen)}};
+  };
+  for (unsigned round = 0; round < 50; ++round) {
+    analysis_t x{number_of_nodes}, y{number_of_nodes};
+    for (unsigned i = 0; i < 20; ++i) {
+      auto source = node_dist(gen);
+      auto route = random_route();
+      x.insert_or_assign(route.first, source, route.second, 1);
+      y.insert_or_assign(route.first, source, route.second, 1);
+    }
+    auto source = node_dist(gen);
+    routes_t routes;
+    for (unsigned i = 0; i < 30; ++i) {
+      routes.push_back(random_route());
+    }
+    sort_routes(routes);
+    auto number_of_rules = x.flow_graph().number_of_rules();
+    auto new_rules = x.insert_or_assign(source, routes, 2);
+    for (auto &route : routes) {
+      y.insert_or_assign(route.first, source, route.second, 2);
+    }
+    assert(x.flow_graph().number_of_rules() == number_of_rules + new_rules);
+    assert(x.flow_graph().number_of_rules() ==
+           y.flow_graph().number_of_rules());
+    assert(diff(x.flow_graph(), y.flow_graph()).empty());
+    for (nid_t s = 0; s < number_of_nodes; ++s) {
+      assert(flows_per_rule(x.flow_graph(), s) ==
+             flows_per_rule(y.flow_graph(), s));
+    }
+    assert(x.loops_per_flow().size() == y.loops_per_flow().size());
+    assert(x.blackholes_per_flow().size() == y.blackholes_per_flow().size());
+    assert(x.reach_summary().global_stop == y.reach_summary().global_stop);
+  }
+}
+
 static void test_analysis() {
   const std::size_t number_of_nodes = 8;
   const ip_prefix_t ip_prefix = ip_prefix_64_127;
@@ -338,6 +497,139 @@ static void test_refresh() {
   }
 }
 
+static void test_refresh_before_update() {
+  const ip_prefix_t ip_prefix = ip_prefix_64_127;
+
+  spans_t spans{5};
+  analysis_t analysis{spans, 3};
+  analysis.refresh_reach_summary(4);
+  analysis.insert_or_assign(ip_prefix, 0, {1}, 6);
+  analysis.insert_or_assign(ip_prefix, 1, {2}, 8);
+  auto &rs = analysis.reach_summary();
+  assert(rs.global_start == 4);
+  assert(rs.global_stop == 8);
+  assert(rs.history(1, 0, 1).timestamps(9) == timestamps_t({6, 9}));
+}
+
+static void test_started_histories() {
+  const ip_prefix_t ip_prefix = ip_prefix_64_127;
+
+  spans_t spans{5};
+  analysis_t analysis{spans, 3};
+  auto &rs = analysis.reach_summary();
+  assert(rs.started(1).empty());
+  analysis.insert_or_assign(ip_prefix, 1, {2}, 4);
+  analysis.insert_or_assign(ip_prefix, 0, {1}, 6);
+  assert(rs.started(1) == std::vector<std::size_t>({1, 2, 5}));
+  assert(rs.source(5) == 1);
+  assert(rs.target(5) == 2);
+  assert(&rs.history(1, 5) == &rs.history(1, 1, 2));
+
+  // cached ranks follow the global time window
+  auto &history = rs.history(1, 0, 1);
+  check_rank(rs, history, 0.0);
+  analysis.insert_or_assign(ip_prefix, 2, {0}, 8);
+  check_rank(rs, history, 0.5);
+  check_rank(rs, history, 0.5);
+  analysis.refresh_reach_summary(8);
+  check_rank(rs, history, 1.0);
+  // forwarding loop means every node reaches every node, itself included
+  assert(rs.started(1) ==
+         std::vector<std::size_t>({0, 1, 2, 3, 4, 5, 6, 7, 8}));
+}
+
+static void test_order_statistic_tree() {
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> dist(0, 200);
+  order_statistic_tree_t<int> tree;
+  std::set<int> set;
+  for (int i = 0; i < 5000; ++i) {
+    auto key = dist(gen);
+    if (i % 3 == 0) {
+      assert(tree.erase(key) == (set.erase(key) == 1));
+    } else {
+      assert(tree.insert(key) == set.insert(key).second);
+    }
+    assert(tree.size() == set.size());
+    auto lower = set.lower_bound(key);
+    assert(tree.count_less(key) ==
+           static_cast<std::size_t>(std::distance(set.begin(), lower)));
+    if (lower != set.end()) {
+      assert(tree.at(tree.count_less(key)) == *lower);
+    }
+  }
+}
+
+static void test_top_k() {
+  const std::size_t number_of_nodes = 6;
+  const ip_prefix_t ip_prefixes[] = {ip_prefix_64_127, ip_prefix_64_79,
+                                     ip_prefix_128_143};
+  std::mt19937 gen(11);
+  std::uniform_int_distribution<nid_t> node_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<int> prefix_dist(0, 2);
+
+  spans_t spans{1000, 100000};
+  analysis_t analysis{spans, number_of_nodes};
+  auto &rs = analysis.reach_summary();
+  assert(rs.top_k(10).empty());
+  timestamp_t timestamp = 1;
+  for (int i = 0; i < 400; ++i) {
+    timestamp += 1 + node_dist(gen) * 7;
+    auto &ip_prefix = ip_prefixes[prefix_dist(gen)];
+    auto s = node_dist(gen);
+    auto t = node_dist(gen);
+    if (t == s or i % 4 == 0) {
+      analysis.erase(ip_prefix, s, timestamp);
+    } else {
+      analysis.insert_or_assign(ip_prefix, s, {t}, timestamp);
+    }
+    if (i == 200) {
+      analysis.refresh_reach_summary(timestamp);
+    }
+  }
+
+  // brute force over all started histories
+  ranks_t ranks;
+  for (flow_id_t flow_id = 0; flow_id < 8; ++flow_id) {
+    ranks_t flow_ranks;
+    for (auto index : rs.started(flow_id)) {
+      if (rs.source(index) != rs.target(index)) {
+        flow_ranks.push_back(rs.ranks(rs.history(flow_id, index)).front());
+      }
+    }
+    std::sort(flow_ranks.rbegin(), flow_ranks.rend());
+    auto flow_top_k = rs.top_k(flow_id, 5);
+    assert(flow_top_k.size() == std::min<std::size_t>(5, flow_ranks.size()));
+    for (std::size_t i = 0; i < flow_top_k.size(); ++i) {
+      assert(flow_top_k[i].flow_id == flow_id);
+      assert(flow_top_k[i].rank == flow_ranks[i]);
+    }
+    ranks.insert(ranks.end(), flow_ranks.begin(), flow_ranks.end());
+  }
+  assert(not ranks.empty());
+  std::sort(ranks.rbegin(), ranks.rend());
+
+  auto top_k = rs.top_k(ranks.size() + 1);
+  assert(top_k.size() == ranks.size());
+  double last_percentile = 100.0;
+  for (std::size_t i = 0; i < top_k.size(); ++i) {
+    auto &ranked_reach = top_k[i];
+    assert(ranked_reach.rank == ranks[i]);
+    assert(ranked_reach.rank == rs.ranks(rs.history(ranked_reach.flow_id,
+                                                     ranked_reach.source,
+                                                     ranked_reach.target))
+                                    .front());
+    auto percentile = rs.percentile(ranked_reach.flow_id, ranked_reach.source,
+                                    ranked_reach.target);
+    assert(percentile <= last_percentile);
+    assert(100.0 * (ranks.size() - i) / ranks.size() <= percentile);
+    last_percentile = percentile;
+  }
+  assert(rs.percentile(top_k.front().flow_id, top_k.front().source,
+                       top_k.front().target) == 100.0);
+  assert(rs.top_k(3).size() == 3);
+}
+
 static timestamps_t simple_intersect(const timestamps_t &a, const timestamps_t &b) {
   if (a.empty() or b.empty()) {
     return {};
@@ -499,7 +791,16 @@ void run_analysis_test() {
   test_history();
   test_loop();
   test_loop_with_different_ip_prefixes();
+  test_loop_with_ecmp();
+  test_equivalence_classes();
+  test_erase_source();
+  test_sort_routes();
+  test_bulk_insert();
   test_analysis();
   test_refresh();
+  test_refresh_before_update();
+  test_started_histories();
+  test_order_statistic_tree();
+  test_top_k();
   test_intersection_of_timestamps();
 }
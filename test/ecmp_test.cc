@@ -0,0 +1,123 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "ecmp_test.hh"
+#include "ipv4_test_data.hh"
+
+#include <ecmp.hh>
+
+#include <algorithm>
+#include <random>
+
+using namespace nopticon;
+
+//   a  ->  c
+//  ^ |    ^ |
+//  | V    | V
+//   b  <-  d
+static void test_find_cycles() {
+  const ip_addr_t a{0}, b{1}, c{2}, d{3};
+  analysis_t analysis{4};
+  analysis.insert_or_assign(ip_prefix_0_15, a, {b, c});
+  analysis.insert_or_assign(ip_prefix_0_15, b, {a});
+  analysis.insert_or_assign(ip_prefix_0_15, c, {d});
+  analysis.insert_or_assign(ip_prefix_0_15, d, {b});
+  auto flow = analysis.flow_graph().flow_tree().find(ip_prefix_0_15);
+  assert(find_cycles(flow, 0).empty());
+  assert(find_cycles(flow, 1) == loops_t({{a, b}}));
+  assert(find_cycles(flow, 8) == loops_t({{a, b}, {a, c, d, b}}));
+
+  // complete graph, where the next hop d has no rule
+  analysis.insert_or_assign(ip_prefix_0_15, a, {b, c, d});
+  analysis.insert_or_assign(ip_prefix_0_15, b, {a, c});
+  analysis.insert_or_assign(ip_prefix_0_15, c, {a, b});
+  analysis.erase(ip_prefix_0_15, d);
+  assert(find_cycles(flow, 8) ==
+         loops_t({{a, b}, {a, b, c}, {a, c}, {a, c, b}, {b, c}}));
+}
+
+// a -> b -> d -> e
+//  \        ^
+//   -> c --
+static void test_count_paths() {
+  const ip_addr_t a{0}, b{1}, c{2}, d{3}, e{4};
+  analysis_t analysis{5};
+  analysis.insert_or_assign(ip_prefix_0_15, a, {b, c});
+  analysis.insert_or_assign(ip_prefix_0_15, b, {d});
+  analysis.insert_or_assign(ip_prefix_0_15, c, {d});
+  analysis.insert_or_assign(ip_prefix_0_15, d, {e});
+  auto flow = analysis.flow_graph().flow_tree().find(ip_prefix_0_15);
+
+  path_counts_t counts;
+  assert(count_paths(flow, a, counts));
+  assert(counts == path_counts_t({{a, 1}, {b, 1}, {c, 1}, {d, 2}, {e, 2}}));
+  assert(count_paths(flow, c, counts));
+  assert(counts == path_counts_t({{c, 1}, {d, 1}, {e, 1}}));
+  assert(count_paths(flow, e, counts));
+  assert(counts == path_counts_t({{e, 1}}));
+
+  // a loop that is not reachable from c does not matter
+  analysis.insert_or_assign(ip_prefix_0_15, b, {a, d});
+  assert(not count_paths(flow, a, counts));
+  assert(count_paths(flow, c, counts));
+}
+
+static std::size_t count_cycles(const std::vector<target_t> &targets,
+                                nid_t s, nid_t n, std::vector<bool> &seen) {
+  std::size_t count = 0;
+  for (auto t : targets[n]) {
+    if (t == s) {
+      ++count;
+    } else if (s < t and not seen[t]) {
+      seen[t] = true;
+      count += count_cycles(targets, s, t, seen);
+      seen[t] = false;
+    }
+  }
+  return count;
+}
+
+static void test_random_cycles() {
+  constexpr std::size_t number_of_nodes = 6;
+  std::mt19937 gen(3);
+  std::bernoulli_distribution is_edge(0.4);
+  for (unsigned round = 0; round < 50; ++round) {
+    analysis_t analysis{number_of_nodes};
+    std::vector<target_t> targets(number_of_nodes);
+    for (nid_t s = 0; s < number_of_nodes; ++s) {
+      for (nid_t t = 0; t < number_of_nodes; ++t) {
+        if (is_edge(gen)) {
+          targets[s].push_back(t);
+        }
+      }
+      analysis.insert_or_assign(ip_prefix_0_15, s, targets[s]);
+    }
+    auto flow = analysis.flow_graph().flow_tree().find(ip_prefix_0_15);
+
+    std::size_t count = 0;
+    std::vector<bool> seen(number_of_nodes);
+    for (nid_t s = 0; s < number_of_nodes; ++s) {
+      count += count_cycles(targets, s, s, seen);
+    }
+    auto cycles = find_cycles(flow, SIZE_MAX);
+    assert(cycles.size() == count);
+    std::sort(cycles.begin(), cycles.end());
+    assert(std::unique(cycles.begin(), cycles.end()) == cycles.end());
+    for (auto &cycle : cycles) {
+      assert(check_loop(flow, cycle));
+      assert(std::min_element(cycle.begin(), cycle.end()) == cycle.begin());
+    }
+    assert(find_cycles(flow, count / 2).size() == count / 2);
+
+    path_counts_t counts;
+    if (count == 0) {
+      assert(count_paths(flow, 0, counts));
+    }
+  }
+}
+
+void run_ecmp_test() {
+  test_find_cycles();
+  test_count_paths();
+  test_random_cycles();
+}
@@ -0,0 +1,139 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "flow_check_test.hh"
+#include "ipv4_test_data.hh"
+
+#include <analysis.hh>
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+using namespace nopticon;
+
+static std::vector<nid_t> reachable(const flow_check_t &flow_check, nid_t s) {
+  std::vector<nid_t> result;
+  flow_check.for_each_reachable(s, [&](nid_t t) { result.push_back(t); });
+  return result;
+}
+
+//   a  ->  c  ->  d
+//  ^ |
+//  | V
+//   b      e <-
+//          |  |
+//           --
+static void test_check() {
+  const ip_addr_t a{0}, b{1}, c{2}, d{3}, e{4};
+  analysis_t analysis{5};
+  analysis.insert_or_assign(ip_prefix_0_15, a, {b, c});
+  analysis.insert_or_assign(ip_prefix_0_15, b, {a});
+  analysis.insert_or_assign(ip_prefix_0_15, c, {d});
+  analysis.insert_or_assign(ip_prefix_0_15, e, {e});
+  auto flow = analysis.flow_graph().flow_tree().find(ip_prefix_0_15);
+
+  auto &flow_check = analysis.check(flow);
+  assert(flow_check.loops() == loops_t({{a, b}, {e}}));
+  assert(flow_check.blackholes() == std::vector<nid_t>({d}));
+  assert(reachable(flow_check, a) == std::vector<nid_t>({a, b, c, d}));
+  assert(reachable(flow_check, b) == std::vector<nid_t>({a, b, c, d}));
+  assert(reachable(flow_check, c) == std::vector<nid_t>({d}));
+  assert(reachable(flow_check, d).empty());
+  assert(reachable(flow_check, e) == std::vector<nid_t>({e}));
+  assert(flow_check.is_reachable(a, d));
+  assert(not flow_check.is_reachable(c, a));
+  assert(not flow_check.is_reachable(d, d));
+
+  // results of each update are kept per flow
+  assert(analysis.loops_per_flow().at(flow) == flow_check.loops());
+  assert(analysis.blackholes_per_flow().at(flow) == flow_check.blackholes());
+  analysis.insert_or_assign(ip_prefix_0_15, d, {});
+  analysis.erase(ip_prefix_0_15, e);
+  assert(analysis.blackholes_per_flow().empty());
+  assert(analysis.loops_per_flow().at(flow) == loops_t({{a, b}}));
+  analysis.insert_or_assign(ip_prefix_0_15, b, {c});
+  assert(analysis.ok());
+}
+
+static void test_random_check() {
+  constexpr std::size_t number_of_nodes = 70;
+  std::mt19937 gen(5);
+  std::uniform_int_distribution<nid_t> nid_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<unsigned> degree_dist(0, 2);
+  for (unsigned round = 0; round < 30; ++round) {
+    analysis_t analysis{number_of_nodes};
+    std::vector<target_t> targets(number_of_nodes);
+    std::vector<bool> has_rule(number_of_nodes);
+    for (unsigned i = 0; i < 50; ++i) {
+      auto s = nid_dist(gen);
+      target_t target;
+      for (auto degree = degree_dist(gen); degree != 0; --degree) {
+        target.push_back(nid_dist(gen));
+      }
+      analysis.insert_or_assign(ip_prefix_0_15, s, target);
+      targets[s] = target;
+      has_rule[s] = true;
+    }
+    auto flow = analysis.flow_graph().flow_tree().find(ip_prefix_0_15);
+    auto &flow_check = analysis.check(flow);
+
+    // reference reachability and blackholes
+    std::vector<std::vector<bool>> reach(number_of_nodes);
+    std::set<nid_t> blackholes;
+    for (nid_t s = 0; s < number_of_nodes; ++s) {
+      reach[s].resize(number_of_nodes);
+      if (not has_rule[s]) {
+        continue;
+      }
+      std::vector<nid_t> stack{s};
+      while (not stack.empty()) {
+        auto n = stack.back();
+        stack.pop_back();
+        for (auto t : targets[n]) {
+          if (not has_rule[t]) {
+            blackholes.insert(t);
+          }
+          if (not reach[s][t]) {
+            reach[s][t] = true;
+            stack.push_back(t);
+          }
+        }
+      }
+      for (nid_t t = 0; t < number_of_nodes; ++t) {
+        assert(flow_check.is_reachable(s, t) == reach[s][t]);
+      }
+    }
+    assert(flow_check.blackholes() ==
+           std::vector<nid_t>(blackholes.begin(), blackholes.end()));
+
+    // one loop through the smallest node of each cyclic component
+    std::set<nid_t> smallest;
+    for (nid_t s = 0; s < number_of_nodes; ++s) {
+      if (not reach[s][s]) {
+        continue;
+      }
+      auto min = s;
+      for (nid_t t = 0; t < s; ++t) {
+        if (reach[s][t] and reach[t][s]) {
+          min = t;
+          break;
+        }
+      }
+      smallest.insert(min);
+    }
+    assert(flow_check.loops().size() == smallest.size());
+    for (auto &loop : flow_check.loops()) {
+      assert(smallest.count(loop.front()) == 1);
+      assert(check_loop(flow, loop));
+      std::set<nid_t> nodes(loop.begin(), loop.end());
+      assert(nodes.size() == loop.size());
+    }
+    assert(analysis.ok() == smallest.empty());
+  }
+}
+
+void run_flow_check_test() {
+  test_check();
+  test_random_check();
+}
@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <flow_graph.hh>
 #include <iostream>
+#include <map>
+#include <random>
 #include <sstream>
 #include <tuple>
 
@@ -116,8 +118,23 @@ static void test_flow_graph(const ip_prefix_vec_t &ip_prefix_vec,
     const_flows_t all_flows;
     flow_graph_t flow_graph;
     run(flow_graph, ip_prefix_vec, cmd_vec);
-    for (auto rule_ref = flow_graph.rule_set().rbegin();
-         rule_ref != flow_graph.rule_set().rend(); ++rule_ref) {
+    std::vector<rule_ref_t> rule_refs;
+    for (auto &source_rules : flow_graph.rules_per_source()) {
+      for (auto &pair : source_rules) {
+        rule_refs.push_back(&pair.second);
+      }
+    }
+    assert(rule_refs.size() == flow_graph.number_of_rules());
+    // most specific IP prefixes first
+    ip_prefix_order_t ip_prefix_order;
+    std::sort(rule_refs.begin(), rule_refs.end(),
+              [&](rule_ref_t x, rule_ref_t y) {
+                if (x->source == y->source) {
+                  return ip_prefix_order(y->ip_prefix, x->ip_prefix);
+                }
+                return y->source < x->source;
+              });
+    for (auto rule_ref : rule_refs) {
       auto flow = flow_graph.flow_tree().find(rule_ref->ip_prefix);
       assert(not flow->is_empty());
       auto flows = descendents_except(flow, all_flows);
@@ -214,7 +231,224 @@ static void test_flow_info() {
   assert(data_iter->second == rule_ref);
 }
 
+static void check_inverted_index(const flow_graph_t &flow_graph,
+                                 nid_t number_of_nodes) {
+  std::vector<flow_counts_t> node_flows(number_of_nodes);
+  std::map<std::pair<nid_t, nid_t>, const_flows_t> link_flows;
+  auto flow_iter = flow_graph.flow_tree().iter();
+  do {
+    auto flow = flow_iter.ptr();
+    for (auto &pair : flow->data) {
+      ++node_flows.at(pair.first)[flow];
+      for (auto target : pair.second->target) {
+        ++node_flows.at(target)[flow];
+        link_flows[{pair.first, target}].insert(flow);
+      }
+    }
+  } while (flow_iter.next());
+  for (nid_t s = 0; s < number_of_nodes; ++s) {
+    assert(flow_graph.node_flows(s) == node_flows[s]);
+    for (nid_t t = 0; t < number_of_nodes; ++t) {
+      assert(flow_graph.link_flows(s, t) == link_flows[std::make_pair(s, t)]);
+    }
+  }
+}
+
+static void test_inverted_index() {
+  const nid_t number_of_nodes = 5;
+  const ip_prefix_t ip_prefixes[] = {ip_prefix_0_255,  ip_prefix_64_127,
+                                     ip_prefix_64_79,  ip_prefix_96_127,
+                                     ip_prefix_96_111, ip_prefix_128_143};
+  std::mt19937 gen(5);
+  std::uniform_int_distribution<nid_t> node_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<int> prefix_dist(0, 5);
+  flow_graph_t flow_graph;
+  affected_flows_t affected_flows;
+  assert(flow_graph.node_flows(0).empty());
+  assert(flow_graph.link_flows(0, 1).empty());
+  for (int i = 0; i < 500; ++i) {
+    auto &ip_prefix = ip_prefixes[prefix_dist(gen)];
+    auto source = node_dist(gen);
+    if (i % 3 == 0) {
+      flow_graph.erase(ip_prefix, source, affected_flows);
+    } else {
+      target_t target{node_dist(gen)};
+      if (i % 5 == 0) {
+        target.push_back(node_dist(gen));
+      }
+      flow_graph.insert_or_assign(ip_prefix, source, target, affected_flows);
+    }
+    check_inverted_index(flow_graph, number_of_nodes);
+  }
+}
+
+/// Most specific flow that contains the IP address
+static const_flow_t find_flow(const flow_graph_t &flow_graph, ip_addr_t addr) {
+  const_flow_t flow = &flow_graph.flow_tree();
+  for (bool is_done = false; not is_done;) {
+    is_done = true;
+    for (auto &child : flow->children()) {
+      if (subset(ip_prefix_t{addr, 32}, child.first)) {
+        flow = child.second;
+        is_done = false;
+      }
+    }
+  }
+  return flow;
+}
+
+static bool is_equal(const rule_ref_per_source_t &a,
+                     const rule_ref_per_source_t &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (auto &pair : a) {
+    auto iter = b.find(pair.first);
+    if (iter == b.end() or iter->second->target != pair.second->target) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_diff() {
+  const nid_t number_of_nodes = 4;
+  const ip_prefix_t ip_prefixes[] = {ip_prefix_0_255,  ip_prefix_64_127,
+                                     ip_prefix_64_79,  ip_prefix_96_127,
+                                     ip_prefix_96_111, ip_prefix_128_143};
+  std::mt19937 gen(9);
+  std::uniform_int_distribution<nid_t> node_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<int> prefix_dist(0, 5);
+  affected_flows_t affected_flows;
+  for (int round = 0; round < 100; ++round) {
+    flow_graph_t x, y;
+    auto update = [&](flow_graph_t &flow_graph, int i) {
+      auto &ip_prefix = ip_prefixes[prefix_dist(gen)];
+      auto source = node_dist(gen);
+      if (i % 3 == 0) {
+        flow_graph.erase(ip_prefix, source, affected_flows);
+      } else {
+        flow_graph.insert_or_assign(ip_prefix, source, {node_dist(gen)},
+                                    affected_flows);
+      }
+    };
+    for (int i = 0; i < 10; ++i) {
+      auto state = gen;
+      update(x, i);
+      gen = state;
+      update(y, i);
+    }
+    assert(x.subtree_hash(&x.flow_tree()) == y.subtree_hash(&y.flow_tree()));
+    assert(diff(x, y).empty());
+    for (int i = 0; i < round % 4; ++i) {
+      update(round % 2 ? x : y, i);
+    }
+    auto flow_diffs = diff(x, y);
+    for (ip_addr_t addr = 0; addr < 256; ++addr) {
+      auto a = find_flow(x, addr), b = find_flow(y, addr);
+      bool is_reported = std::any_of(
+          flow_diffs.begin(), flow_diffs.end(), [&](const flow_diff_t &d) {
+            return d.a == a and d.b == b and
+                   subset(ip_prefix_t{addr, 32}, d.ip_prefix);
+          });
+      assert(is_reported != is_equal(a->data, b->data));
+    }
+  }
+}
+
+static void test_equivalence_classes() {
+  const nid_t number_of_nodes = 3;
+  const ip_prefix_t ip_prefixes[] = {ip_prefix_0_255,  ip_prefix_64_127,
+                                     ip_prefix_64_79,  ip_prefix_96_127,
+                                     ip_prefix_96_111, ip_prefix_128_143};
+  std::mt19937 gen(13);
+  std::uniform_int_distribution<nid_t> node_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<int> prefix_dist(0, 5);
+  flow_graph_t flow_graph;
+  affected_flows_t affected_flows;
+  std::vector<const_flow_t> flows, stack;
+  for (int i = 0; i < 300; ++i) {
+    auto &ip_prefix = ip_prefixes[prefix_dist(gen)];
+    auto source = node_dist(gen);
+    if (i % 4 == 0) {
+      flow_graph.erase(ip_prefix, source, affected_flows);
+    } else {
+      flow_graph.insert_or_assign(ip_prefix, source, {node_dist(gen)},
+                                  affected_flows);
+    }
+
+    flows.clear();
+    stack.push_back(&flow_graph.flow_tree());
+    while (not stack.empty()) {
+      auto flow = stack.back();
+      stack.pop_back();
+      if (not flow->data.empty()) {
+        flows.push_back(flow);
+      }
+      for (auto &child : flow->children()) {
+        stack.push_back(child.second);
+      }
+    }
+    std::size_t number_of_representatives = 0;
+    for (auto a : flows) {
+      auto &equivalence_class = flow_graph.equivalence_class(a);
+      bool is_representative = true;
+      for (auto b : flows) {
+        bool is_equivalent = is_equal(a->data, b->data);
+        assert(equivalence_class.count(b) == is_equivalent);
+        if (is_equivalent and b < a) {
+          is_representative = false;
+        }
+      }
+      number_of_representatives += is_representative;
+    }
+    assert(flow_graph.number_of_equivalence_classes() ==
+           number_of_representatives);
+  }
+}
+
+static void test_rules_per_source() {
+  const ip_addr_t a{0}, b{1}, c{2};
+  flow_graph_t flow_graph;
+  affected_flows_t affected_flows;
+  assert(flow_graph.find(ip_prefix_0_15, c) == nullptr);
+  assert(flow_graph.rules(c).empty());
+
+  flow_graph.insert_or_assign(ip_prefix_0_15, a, {b}, affected_flows);
+  flow_graph.insert_or_assign(ip_prefix_0_7, a, {c}, affected_flows);
+  flow_graph.insert_or_assign(ip_prefix_0_15, c, {a}, affected_flows);
+  assert(flow_graph.number_of_rules() == 3);
+  assert(flow_graph.rules(a).size() == 2);
+  assert(flow_graph.rules(b).empty());
+  assert(flow_graph.rules(c).size() == 1);
+
+  // rule handles stay valid while other rules come and go
+  auto rule_ref = flow_graph.find(ip_prefix_0_15, a);
+  assert(rule_ref != nullptr);
+  assert(rule_ref->ip_prefix == ip_prefix_0_15 and rule_ref->source == a);
+  for (unsigned i = 0; i < 64; ++i) {
+    flow_graph.insert_or_assign(ip_prefix_t(i << 8, 24), a, {b},
+                                affected_flows);
+  }
+  assert(flow_graph.find(ip_prefix_0_15, a) == rule_ref);
+  flow_graph.insert_or_assign(ip_prefix_0_15, a, {c}, affected_flows);
+  assert(flow_graph.find(ip_prefix_0_15, a) == rule_ref);
+  assert(rule_ref->target == target_t({c}));
+
+  assert(flow_graph.erase(ip_prefix_0_7, a, affected_flows));
+  assert(not flow_graph.erase(ip_prefix_0_7, a, affected_flows));
+  assert(not flow_graph.erase(ip_prefix_0_7, b, affected_flows));
+  assert(flow_graph.find(ip_prefix_0_7, a) == nullptr);
+  assert(flow_graph.find(ip_prefix_0_15, a) == rule_ref);
+  assert(flow_graph.number_of_rules() == 66);
+  assert(flow_graph.rules(a).size() == 65);
+}
+
 void run_flow_graph_test() {
+  test_inverted_index();
+  test_diff();
+  test_equivalence_classes();
+  test_rules_per_source();
   test_print_ip_prefix();
   test_flow_info();
   test_flow_graph({ip_prefix_w, ip_prefix_x, ip_prefix_y, ip_prefix_z}, 1U);
@@ -0,0 +1,186 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "mrt_test.hh"
+
+#include <mrt.hh>
+
+#include <cassert>
+
+using namespace nopticon;
+
+typedef std::vector<uint8_t> bytes_t;
+
+static void append(bytes_t &bytes, uint32_t value, unsigned n) {
+  while (n-- != 0) {
+    bytes.push_back(value >> (8 * n));
+  }
+}
+
+static void append(bytes_t &bytes, const bytes_t &other) {
+  bytes.insert(bytes.end(), other.begin(), other.end());
+}
+
+static void append_record(bytes_t &bytes, uint32_t timestamp, uint16_t type,
+                          uint16_t subtype, const bytes_t &body) {
+  append(bytes, timestamp, 4);
+  append(bytes, type, 2);
+  append(bytes, subtype, 2);
+  append(bytes, body.size(), 4);
+  append(bytes, body);
+}
+
+// one IPv4 peer with a 2-byte AS number, and one IPv6 peer with a 4-byte
+// AS number
+static bytes_t make_peer_index_table() {
+  bytes_t body;
+  append(body, 0x0a0000ff, 4);
+  append(body, 4, 2);
+  append(body, {'v', 'i', 'e', 'w'});
+  append(body, 2, 2);
+  append(body, 0x0, 1);
+  append(body, 0x0a000001, 4);
+  append(body, 0xc0a80001, 4);
+  append(body, 65001, 2);
+  append(body, 0x3, 1);
+  append(body, 0x0a000002, 4);
+  append(body, bytes_t(16, 0x20));
+  append(body, 4200000000, 4);
+  return body;
+}
+
+static bytes_t make_entry(uint16_t peer_index, const bytes_t &attributes,
+                          bool is_add_path = false) {
+  bytes_t entry;
+  append(entry, peer_index, 2);
+  append(entry, 1533679000, 4);
+  if (is_add_path) {
+    append(entry, 7, 4);
+  }
+  append(entry, attributes.size(), 2);
+  append(entry, attributes);
+  return entry;
+}
+
+static bytes_t make_rib(uint8_t len, const bytes_t &prefix,
+                        const std::vector<bytes_t> &entries) {
+  bytes_t body;
+  append(body, 0, 4);
+  append(body, len, 1);
+  append(body, prefix);
+  append(body, entries.size(), 2);
+  for (auto &entry : entries) {
+    append(body, entry);
+  }
+  return body;
+}
+
+static FILE *make_file(const bytes_t &bytes) {
+  auto file = std::tmpfile();
+  assert(file != nullptr);
+  std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::rewind(file);
+  return file;
+}
+
+static void test_mrt_reader() {
+  // ORIGIN, then NEXT_HOP 192.168.0.9 with an extended length
+  const bytes_t next_hop{0x40, 1, 1, 0, 0x50, 3, 0, 4, 192, 168, 0, 9};
+  // abbreviated MP_REACH_NLRI with next hop 10.0.0.7
+  const bytes_t mp_reach{0x80, 14, 5, 4, 10, 0, 0, 7};
+  const bytes_t no_next_hop{0x40, 1, 1, 0};
+
+  bytes_t bytes;
+  // records of other types and subtypes are skipped
+  append_record(bytes, 1533679000, 12, 1, {1, 2, 3});
+  append_record(bytes, 1533679001, 13, 1, make_peer_index_table());
+  append_record(bytes, 1533679002, 13, 2,
+                make_rib(23, {10, 1, 3},
+                         {make_entry(0, next_hop), make_entry(1, mp_reach),
+                          make_entry(1, no_next_hop)}));
+  append_record(bytes, 1533679003, 13, 4, {0, 0, 0, 0, 0});
+  append_record(bytes, 1533679004, 13, 8,
+                make_rib(0, {}, {make_entry(1, next_hop, true)}));
+  auto file = make_file(bytes);
+
+  mrt_reader_t reader{file};
+  mrt_routes_t routes;
+  assert(reader.read(routes));
+  assert(reader.timestamp() == 1533679002);
+  assert(reader.peers().size() == 2);
+  assert(reader.peers()[0].bgp_id == 0x0a000001);
+  assert(reader.peers()[0].ip_addr == 0xc0a80001);
+  assert(reader.peers()[1].bgp_id == 0x0a000002);
+  assert(reader.peers()[1].ip_addr == 0);
+  assert(routes.size() == 2);
+  // host bits beyond the prefix length are cleared
+  const ip_prefix_t ip_prefix{0x0a010200, 23};
+  assert(routes[0].ip_prefix == ip_prefix);
+  assert(routes[0].peer_index == 0);
+  assert(routes[0].next_hop == 0xc0a80009);
+  assert(routes[1].ip_prefix == ip_prefix);
+  assert(routes[1].peer_index == 1);
+  assert(routes[1].next_hop == 0x0a000007);
+  assert(reader.number_of_skipped_routes() == 1);
+
+  assert(reader.read(routes));
+  assert(reader.timestamp() == 1533679004);
+  assert(routes.size() == 1);
+  assert(routes[0].ip_prefix == ip_prefix_t());
+  assert(routes[0].peer_index == 1);
+  assert(routes[0].next_hop == 0xc0a80009);
+
+  assert(not reader.read(routes));
+  assert(routes.empty());
+  assert(reader.error().empty());
+  std::fclose(file);
+}
+
+static void test_malformed_mrt() {
+  const bytes_t next_hop{0x40, 3, 4, 10, 0, 0, 1};
+  {
+    bytes_t bytes;
+    append_record(bytes, 1, 13, 1, make_peer_index_table());
+    append_record(bytes, 2, 13, 2,
+                  make_rib(8, {10}, {make_entry(2, next_hop)}));
+    auto file = make_file(bytes);
+    mrt_reader_t reader{file};
+    mrt_routes_t routes;
+    assert(not reader.read(routes));
+    assert(reader.error() == "MRT peer index out of range");
+    std::fclose(file);
+  }
+  {
+    bytes_t bytes;
+    append_record(bytes, 1, 13, 1, make_peer_index_table());
+    append_record(bytes, 2, 13, 2,
+                  make_rib(8, {10}, {make_entry(0, next_hop)}));
+    bytes.pop_back();
+    auto file = make_file(bytes);
+    mrt_reader_t reader{file};
+    mrt_routes_t routes;
+    assert(not reader.read(routes));
+    assert(reader.error() == "truncated MRT record");
+    // errors are sticky
+    assert(not reader.read(routes));
+    std::fclose(file);
+  }
+  {
+    bytes_t bytes;
+    append_record(bytes, 1, 13, 1, make_peer_index_table());
+    // the attribute is longer than the attributes of the entry
+    append_record(bytes, 2, 13, 2,
+                  make_rib(8, {10}, {make_entry(0, {0x40, 3, 9, 10})}));
+    auto file = make_file(bytes);
+    mrt_reader_t reader{file};
+    mrt_routes_t routes;
+    assert(not reader.read(routes));
+    assert(reader.error() == "malformed MRT path attributes");
+    std::fclose(file);
+  }
+}
+
+void run_mrt_test() {
+  test_mrt_reader();
+  test_malformed_mrt();
+}
@@ -0,0 +1,85 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "next_hops_test.hh"
+#include "ipv4_test_data.hh"
+
+#include <flow_graph.hh>
+
+#include <random>
+#include <set>
+
+using namespace nopticon;
+
+static void test_next_hops_table() {
+  next_hops_table_t next_hops_table;
+  auto empty = next_hops_table.intern({});
+  auto single = next_hops_table.intern({7});
+  assert(next_hops_table.size() == 0);
+  assert(empty.empty());
+  assert(empty == next_hops_t());
+  assert(single.size() == 1 and single[0] == 7);
+  assert(single == next_hops_table.intern({7}));
+  assert(single != next_hops_table.intern({8}));
+  assert(single != empty);
+
+  auto x = next_hops_table.intern({1, 2});
+  auto y = next_hops_table.intern({1, 2});
+  auto z = next_hops_table.intern({2, 1});
+  assert(next_hops_table.size() == 2);
+  assert(x == y and x.begin() == y.begin());
+  assert(x != z);
+  assert(x == target_t({1, 2}));
+  assert(target_t({2, 1}) == z);
+  assert(x != target_t({1}));
+  assert(target_t(z) == target_t({2, 1}));
+
+  next_hops_table.release(x);
+  assert(next_hops_table.size() == 2);
+  assert(y == target_t({1, 2}));
+  next_hops_table.release(y);
+  next_hops_table.release(z);
+  assert(next_hops_table.size() == 0);
+}
+
+static void test_shared_next_hops() {
+  const nid_t number_of_nodes = 4;
+  const ip_prefix_t ip_prefixes[] = {ip_prefix_0_255,  ip_prefix_64_127,
+                                     ip_prefix_64_79,  ip_prefix_96_127,
+                                     ip_prefix_96_111, ip_prefix_128_143};
+  std::mt19937 gen(17);
+  std::uniform_int_distribution<nid_t> node_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<int> prefix_dist(0, 5);
+  flow_graph_t flow_graph;
+  affected_flows_t affected_flows;
+  for (int i = 0; i < 400; ++i) {
+    auto &ip_prefix = ip_prefixes[prefix_dist(gen)];
+    auto source = node_dist(gen);
+    if (i % 4 == 0) {
+      flow_graph.erase(ip_prefix, source, affected_flows);
+    } else {
+      target_t target;
+      for (auto n = node_dist(gen); n != 0; --n) {
+        target.push_back(node_dist(gen));
+      }
+      flow_graph.insert_or_assign(ip_prefix, source, target, affected_flows);
+      assert(flow_graph.find(ip_prefix, source)->target == target);
+    }
+
+    // only sequences that are still in use stay interned
+    std::set<target_t> targets;
+    for (auto &source_rules : flow_graph.rules_per_source()) {
+      for (auto &pair : source_rules) {
+        if (pair.second.target.size() > 1) {
+          targets.insert(pair.second.target);
+        }
+      }
+    }
+    assert(flow_graph.next_hops_table().size() == targets.size());
+  }
+}
+
+void run_next_hops_test() {
+  test_next_hops_table();
+  test_shared_next_hops();
+}
@@ -0,0 +1,154 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "path_query_test.hh"
+#include "ipv4_test_data.hh"
+
+#include <analysis.hh>
+
+#include <algorithm>
+#include <random>
+
+using namespace nopticon;
+
+// a -> {b, c}, b -> d, c -> d, d -> {e, f}, f -> a
+static void test_path_query() {
+  const ip_addr_t a{0}, b{1}, c{2}, d{3}, e{4}, f{5}, g{6};
+  analysis_t analysis{7};
+  analysis.insert_or_assign(ip_prefix_0_15, a, {b, c});
+  analysis.insert_or_assign(ip_prefix_0_15, b, {d});
+  analysis.insert_or_assign(ip_prefix_0_15, c, {d});
+  analysis.insert_or_assign(ip_prefix_0_15, d, {e, f});
+  analysis.insert_or_assign(ip_prefix_0_15, f, {a});
+  auto flow = analysis.flow_graph().flow_tree().find(ip_prefix_0_15);
+
+  path_query_t path_query{7};
+  path_query.build(flow, a);
+  assert(path_query.is_reachable(a));
+  assert(path_query.is_reachable(e));
+  assert(not path_query.is_reachable(g));
+  assert(path_query.is_waypoint(a, e));
+  assert(path_query.is_waypoint(d, e));
+  assert(path_query.is_waypoint(e, e));
+  assert(not path_query.is_waypoint(b, e));
+  assert(not path_query.is_waypoint(e, d));
+  assert(not path_query.is_waypoint(a, g));
+  assert(path_query.waypoints(e) == path_t({a, d, e}));
+  assert(path_query.waypoints(g).empty());
+  assert(path_query.paths(e, 8) == paths_t({{a, b, d, e}, {a, c, d, e}}));
+  assert(path_query.paths(e, 1) == paths_t({{a, b, d, e}}));
+  assert(path_query.paths(a, 8) == paths_t({{a}}));
+
+  // rebuilding for another source forgets the previous one
+  path_query.build(flow, c);
+  assert(path_query.is_waypoint(c, e));
+  assert(not path_query.is_waypoint(a, e));
+  assert(path_query.waypoints(b) == path_t({c, d, f, a, b}));
+  assert(path_query.paths(b, 8) == paths_t({{c, d, f, a, b}}));
+}
+
+static bool is_reachable(const std::vector<target_t> &targets, nid_t s,
+                         nid_t t, nid_t avoid) {
+  if (s == avoid or t == avoid) {
+    return false;
+  }
+  std::vector<bool> visited(targets.size());
+  std::vector<nid_t> stack{s};
+  visited[s] = true;
+  while (not stack.empty()) {
+    auto n = stack.back();
+    stack.pop_back();
+    if (n == t) {
+      return true;
+    }
+    for (auto w : targets[n]) {
+      if (w != avoid and not visited[w]) {
+        visited[w] = true;
+        stack.push_back(w);
+      }
+    }
+  }
+  return false;
+}
+
+static std::size_t count_paths(const std::vector<target_t> &targets, nid_t n,
+                               nid_t t, std::vector<bool> &is_on_path) {
+  if (n == t) {
+    return 1;
+  }
+  std::size_t count = 0;
+  is_on_path[n] = true;
+  for (auto w : targets[n]) {
+    if (not is_on_path[w]) {
+      count += count_paths(targets, w, t, is_on_path);
+    }
+  }
+  is_on_path[n] = false;
+  return count;
+}
+
+static void test_random_path_query() {
+  constexpr std::size_t number_of_nodes = 9;
+  constexpr nid_t none = number_of_nodes;
+  std::mt19937 gen(11);
+  std::bernoulli_distribution is_edge(0.25);
+  path_query_t path_query{number_of_nodes};
+  for (unsigned round = 0; round < 40; ++round) {
+    analysis_t analysis{number_of_nodes};
+    std::vector<target_t> targets(number_of_nodes);
+    for (nid_t s = 0; s < number_of_nodes; ++s) {
+      for (nid_t t = 0; t < number_of_nodes; ++t) {
+        if (is_edge(gen)) {
+          targets[s].push_back(t);
+        }
+      }
+      if (not targets[s].empty()) {
+        analysis.insert_or_assign(ip_prefix_0_15, s, targets[s]);
+      }
+    }
+    auto flow = analysis.flow_graph().flow_tree().find(ip_prefix_0_15);
+    if (flow == nullptr) {
+      continue;
+    }
+    for (nid_t s = 0; s < number_of_nodes; ++s) {
+      path_query.build(flow, s);
+      for (nid_t t = 0; t < number_of_nodes; ++t) {
+        auto reachable = is_reachable(targets, s, t, none);
+        assert(path_query.is_reachable(t) == reachable);
+        for (nid_t w = 0; w < number_of_nodes; ++w) {
+          auto is_avoidable = w != t and is_reachable(targets, s, t, w);
+          assert(path_query.is_waypoint(w, t) ==
+                 (reachable and not is_avoidable));
+        }
+        auto waypoints = path_query.waypoints(t);
+        for (auto w : waypoints) {
+          assert(path_query.is_waypoint(w, t));
+        }
+
+        std::vector<bool> is_on_path(number_of_nodes);
+        auto count = count_paths(targets, s, t, is_on_path);
+        auto paths = path_query.paths(t, SIZE_MAX);
+        assert(paths.size() == count);
+        for (auto &path : paths) {
+          assert(path.front() == s and path.back() == t);
+          for (std::size_t i = 0; i + 1 < path.size(); ++i) {
+            auto &target = targets[path[i]];
+            assert(std::find(target.begin(), target.end(), path[i + 1]) !=
+                   target.end());
+          }
+          // every path goes through the waypoints in order
+          auto iter = path.begin();
+          for (auto w : waypoints) {
+            iter = std::find(iter, path.end(), w);
+            assert(iter != path.end());
+          }
+        }
+      }
+    }
+  }
+}
+
+void run_path_query_test() {
+  test_path_query();
+  test_random_path_query();
+}
@@ -0,0 +1,97 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "policy_test.hh"
+#include "ipv4_test_data.hh"
+
+#include <analysis.hh>
+
+using namespace nopticon;
+
+static void test_reachability() {
+  analysis_t analysis{4};
+  auto id = analysis.insert_policy(
+      {policy_type_t::REACHABILITY, ip_prefix_64_127, {{0, 2}}});
+  auto &policy_monitor = analysis.policy_monitor();
+  assert(not policy_monitor.holds(id));
+
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {1});
+  assert(policy_monitor.events().empty());
+  analysis.insert_or_assign(ip_prefix_64_127, 1, {2});
+  assert(policy_monitor.holds(id));
+  assert(policy_monitor.events().size() == 1);
+  assert(policy_monitor.events().front().policy_id == id);
+  assert(policy_monitor.events().front().holds);
+
+  // other flows are not checked
+  analysis.insert_or_assign(ip_prefix_128_143, 1, {3});
+  assert(policy_monitor.events().empty());
+
+  analysis.erase(ip_prefix_64_127, 1);
+  assert(not policy_monitor.holds(id));
+  assert(policy_monitor.events().size() == 1);
+  assert(not policy_monitor.events().front().holds);
+}
+
+static void test_more_specific_ip_prefix() {
+  analysis_t analysis{4};
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {1});
+  auto id = analysis.insert_policy(
+      {policy_type_t::REACHABILITY, ip_prefix_64_127, {{0, 1}}});
+  auto &policy_monitor = analysis.policy_monitor();
+  assert(policy_monitor.holds(id));
+
+  // [64:79] takes its rule for node 0 from [64:127]
+  auto sub_id = analysis.insert_policy(
+      {policy_type_t::REACHABILITY, ip_prefix_64_79, {{0, 1}}});
+  assert(not policy_monitor.holds(sub_id));
+  analysis.insert_or_assign(ip_prefix_64_79, 2, {3});
+  assert(policy_monitor.holds(sub_id));
+  assert(policy_monitor.events().size() == 1);
+  assert(policy_monitor.events().front().policy_id == sub_id);
+
+  analysis.insert_or_assign(ip_prefix_64_79, 0, {2});
+  assert(policy_monitor.holds(id));
+  assert(not policy_monitor.holds(sub_id));
+}
+
+static void test_waypoint() {
+  analysis_t analysis{5};
+  auto id = analysis.insert_policy(
+      {policy_type_t::WAYPOINT, ip_prefix_64_127, {{0, 2, 4}}});
+  auto &policy_monitor = analysis.policy_monitor();
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {1, 2});
+  analysis.insert_or_assign(ip_prefix_64_127, 2, {4});
+  assert(policy_monitor.holds(id));
+
+  // equal-cost path that bypasses the waypoint
+  analysis.insert_or_assign(ip_prefix_64_127, 1, {3});
+  assert(policy_monitor.holds(id));
+  analysis.insert_or_assign(ip_prefix_64_127, 3, {4});
+  assert(not policy_monitor.holds(id));
+
+  analysis.insert_or_assign(ip_prefix_64_127, 1, {2});
+  assert(policy_monitor.holds(id));
+}
+
+static void test_path_preference() {
+  analysis_t analysis{4};
+  auto id = analysis.insert_policy(
+      {policy_type_t::PATH_PREFERENCE, ip_prefix_64_127,
+       {{0, 1, 3}, {0, 2, 3}}});
+  auto &policy_monitor = analysis.policy_monitor();
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {2});
+  analysis.insert_or_assign(ip_prefix_64_127, 2, {3});
+  analysis.insert_or_assign(ip_prefix_64_127, 1, {3});
+  assert(not policy_monitor.holds(id));
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {1});
+  assert(policy_monitor.holds(id));
+  assert(policy_monitor.events().size() == 1);
+}
+
+void run_policy_test() {
+  test_reachability();
+  test_more_specific_ip_prefix();
+  test_waypoint();
+  test_path_preference();
+}
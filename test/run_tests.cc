@@ -4,14 +4,28 @@
 #undef NDEBUG
 
 #include "analysis_test.hh"
+#include "ecmp_test.hh"
+#include "flow_check_test.hh"
 #include "flow_graph_test.hh"
 #include "ipv4_test.hh"
+#include "mrt_test.hh"
+#include "next_hops_test.hh"
+#include "path_query_test.hh"
+#include "policy_test.hh"
+#include "what_if_test.hh"
 #include <iostream>
 
 int main() {
   // run_ipv4_test();
   // run_flow_graph_test();
   run_analysis_test();
+  run_ecmp_test();
+  run_flow_check_test();
+  run_mrt_test();
+  run_next_hops_test();
+  run_path_query_test();
+  run_policy_test();
+  run_what_if_test();
   std::cout << "ok" << std::endl;
   return 0;
 }
@@ -0,0 +1,178 @@
+// Copyright 2018 Alex Horn. All rights reserved.
+// Use of this source code is governed by a LICENSE.
+
+#include "what_if_test.hh"
+#include "ipv4_test_data.hh"
+
+#include <what_if.hh>
+
+#include <random>
+
+using namespace nopticon;
+
+static void test_find_loops() {
+  assert(find_loops(forwarding_t{}).empty());
+  assert(find_loops({{0, {1}}, {1, {2}}}).empty());
+  assert(find_loops({{2, {1}}, {1, {3}}, {3, {2}}}) == loops_t({{1, 3, 2}}));
+  assert(find_loops({{0, {0}}}) == loops_t({{0}}));
+  assert(find_reach({{0, {1}}, {1, {2}}, {3, {}}}) ==
+         edges_t({{0, 1}, {0, 2}, {1, 2}}));
+}
+
+static void test_erase() {
+  analysis_t analysis{4};
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {1});
+  analysis.insert_or_assign(ip_prefix_64_127, 1, {2});
+  analysis.insert_or_assign(ip_prefix_0_255, 1, {0});
+
+  what_if_t what_if{analysis};
+  assert(what_if.empty());
+  assert(what_if.diff().empty());
+
+  // falls back to the less specific rule of node 1
+  what_if.erase(ip_prefix_64_127, 1);
+  auto what_if_flows = what_if.diff();
+  assert(what_if_flows.size() == 1);
+  auto &what_if_flow = what_if_flows.front();
+  assert(what_if_flow.ip_prefix == ip_prefix_64_127);
+  assert(what_if_flow.flow == analysis.flow_graph().flow_tree().find(
+                                  ip_prefix_64_127));
+  assert(what_if_flow.loops.empty());
+  assert(what_if_flow.hypothetical_loops == loops_t({{0, 1}}));
+  assert(what_if_flow.hypothetical_forwarding.at(1) == target_t({0}));
+  assert(what_if_flow.lost_reach == edges_t({{0, 2}, {1, 2}}));
+  assert(what_if_flow.gained_reach == edges_t({{0, 0}, {1, 0}, {1, 1}}));
+
+  // analysis is untouched
+  assert(analysis.flow_graph().find(ip_prefix_64_127, 1)->target ==
+         target_t({2}));
+  assert(analysis.ok());
+}
+
+static void test_new_ip_prefix() {
+  analysis_t analysis{4};
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {1});
+  analysis.insert_or_assign(ip_prefix_96_111, 0, {2});
+
+  what_if_t what_if{analysis};
+  what_if.insert_or_assign(ip_prefix_96_127, 0, {3});
+  auto what_if_flows = what_if.diff();
+  // [96:111] keeps its more specific rule
+  assert(what_if_flows.size() == 1);
+  auto &what_if_flow = what_if_flows.front();
+  assert(what_if_flow.ip_prefix == ip_prefix_96_127);
+  assert(what_if_flow.flow == nullptr);
+  assert(what_if_flow.base->ip_prefix == ip_prefix_64_127);
+  assert(what_if_flow.gained_reach == edges_t({{0, 3}}));
+  assert(what_if_flow.lost_reach == edges_t({{0, 1}}));
+}
+
+static void test_fail() {
+  analysis_t analysis{4};
+  analysis.insert_or_assign(ip_prefix_64_127, 0, {1, 2});
+  analysis.insert_or_assign(ip_prefix_64_127, 1, {3});
+  analysis.insert_or_assign(ip_prefix_64_127, 2, {3});
+  analysis.insert_or_assign(ip_prefix_128_143, 3, {1});
+  analysis.insert_or_assign(ip_prefix_0_255, 2, {1});
+
+  what_if_t what_if{analysis};
+  what_if.fail(1);
+  auto what_if_flows = what_if.diff();
+  assert(what_if_flows.size() == 3);
+  assert(what_if_flows[0].ip_prefix == ip_prefix_0_255);
+  assert(what_if_flows[0].hypothetical_forwarding.empty());
+  assert(what_if_flows[1].ip_prefix == ip_prefix_64_127);
+  assert(what_if_flows[1].hypothetical_forwarding ==
+         forwarding_t({{0, {2}}, {2, {3}}}));
+  assert(what_if_flows[2].ip_prefix == ip_prefix_128_143);
+  assert(what_if_flows[2].forwarding == forwarding_t({{2, {1}}, {3, {1}}}));
+  assert(what_if_flows[2].hypothetical_forwarding.empty());
+}
+
+/// Most specific flow that contains the IP prefix
+static const_flow_t find_flow(const flow_tree_t &flow_tree,
+                              const ip_prefix_t &ip_prefix) {
+  const_flow_t flow = &flow_tree;
+  for (bool is_done = false; not is_done;) {
+    is_done = true;
+    for (auto &child : flow->children()) {
+      if (subset(ip_prefix, child.first)) {
+        flow = child.second;
+        is_done = false;
+      }
+    }
+  }
+  return flow;
+}
+
+/// Compares a fork against a copy of the analysis with the same changes
+static void test_random() {
+  const nid_t number_of_nodes = 5;
+  const ip_prefix_t ip_prefixes[] = {ip_prefix_0_255,  ip_prefix_64_127,
+                                     ip_prefix_64_79,  ip_prefix_96_127,
+                                     ip_prefix_96_111, ip_prefix_128_143};
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<nid_t> node_dist(0, number_of_nodes - 1);
+  std::uniform_int_distribution<int> prefix_dist(0, 5);
+  for (int round = 0; round < 50; ++round) {
+    analysis_t analysis{number_of_nodes}, expected{number_of_nodes};
+    for (int i = 0; i < 8; ++i) {
+      auto &ip_prefix = ip_prefixes[prefix_dist(gen)];
+      auto source = node_dist(gen);
+      target_t target{node_dist(gen)};
+      analysis.insert_or_assign(ip_prefix, source, target);
+      expected.insert_or_assign(ip_prefix, source, target);
+    }
+    what_if_t what_if{analysis};
+    for (int i = 0; i < 3; ++i) {
+      auto &ip_prefix = ip_prefixes[prefix_dist(gen)];
+      auto source = node_dist(gen);
+      if (i == 1) {
+        what_if.erase(ip_prefix, source);
+        expected.erase(ip_prefix, source);
+      } else {
+        target_t target{node_dist(gen)};
+        what_if.insert_or_assign(ip_prefix, source, target);
+        expected.insert_or_assign(ip_prefix, source, target);
+      }
+    }
+    auto what_if_flows = what_if.diff();
+    // every flow that would change is reported
+    auto flow_iter = expected.flow_graph().flow_tree().iter();
+    do {
+      auto flow = flow_iter.ptr();
+      auto base = find_flow(analysis.flow_graph().flow_tree(), flow->ip_prefix);
+      forwarding_t forwarding, expected_forwarding;
+      for (auto &pair : base->data) {
+        forwarding.emplace(pair.first, pair.second->target);
+      }
+      for (auto &pair : flow->data) {
+        expected_forwarding.emplace(pair.first, pair.second->target);
+      }
+      if (forwarding != expected_forwarding) {
+        assert(std::any_of(what_if_flows.begin(), what_if_flows.end(),
+                           [&](const what_if_flow_t &what_if_flow) {
+                             return what_if_flow.ip_prefix == flow->ip_prefix;
+                           }));
+      }
+    } while (flow_iter.next());
+    for (auto &what_if_flow : what_if_flows) {
+      auto flow =
+          find_flow(expected.flow_graph().flow_tree(), what_if_flow.ip_prefix);
+      forwarding_t forwarding;
+      for (auto &pair : flow->data) {
+        forwarding.emplace(pair.first, pair.second->target);
+      }
+      assert(what_if_flow.hypothetical_forwarding == forwarding);
+      assert(what_if_flow.hypothetical_loops == find_loops(forwarding));
+    }
+  }
+}
+
+void run_what_if_test() {
+  test_find_loops();
+  test_erase();
+  test_new_ip_prefix();
+  test_fail();
+  test_random();
+}